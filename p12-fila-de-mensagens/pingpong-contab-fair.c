@@ -0,0 +1,62 @@
+// PingPongOS - PingPong Operating System
+
+// Teste da política justa - tarefas com prioridades distintas disputam o
+// processador durante o mesmo intervalo; o tempo de processamento de cada
+// uma deve ser proporcional ao peso da sua prioridade
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define DURATION 5000
+
+task_t Pang, Peng, Ping, Pong, Pung ;
+
+// corpo das threads
+void Body (void * arg)
+{
+   long soma = 0 ;
+
+   printf ("%s: inicio em %4d ms (prio: %d)\n", (char *) arg,
+           systime(), task_getprio(NULL)) ;
+
+   // processa até o fim do intervalo de teste
+   while (systime() < DURATION)
+      soma++ ;
+
+   printf ("%s: fim    em %4d ms\n", (char *) arg, systime()) ;
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   printf ("main: inicio\n");
+
+   ppos_init_policy (POLICY_FAIR) ;
+
+   task_create (&Pang, Body, "    Pang") ;
+   task_setprio (&Pang, 0);
+
+   task_create (&Peng, Body, "        Peng") ;
+   task_setprio (&Peng, -2);
+
+   task_create (&Ping, Body, "            Ping") ;
+   task_setprio (&Ping, -4);
+
+   task_create (&Pong, Body, "                Pong") ;
+   task_setprio (&Pong, -6);
+
+   task_create (&Pung, Body, "                    Pung") ;
+   task_setprio (&Pung, -8);
+
+   task_join (&Pang) ;
+   task_join (&Peng) ;
+   task_join (&Ping) ;
+   task_join (&Pong) ;
+   task_join (&Pung) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,76 @@
+// PingPongOS - PingPong Operating System
+
+// Teste da pilha compartilhada - muitas tarefas, quase sempre paradas,
+// alternam o processador; cada uma usa pouco da sua pilha. Com o argumento
+// "shared" as tarefas executam na pilha compartilhada (copy_stack), senão
+// cada uma tem a sua própria pilha. Compare o tempo de cada troca e a
+// memória das pilhas informada no encerramento do sistema.
+// Uso: pingpong-copystack [shared]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ppos.h"
+
+#define NUMTASKS 10000
+#define ROUNDS   20
+
+task_t task[NUMTASKS] ;
+long soma = 0 ;
+
+// corpo das threads: mantém alguns dados na pilha entre as trocas
+void Body (void * arg)
+{
+   volatile long dados[64] ;
+   int i ;
+
+   for (i=0; i<64; i++)
+      dados[i] = (long) arg ;
+
+   for (i=0; i<ROUNDS; i++)
+      task_yield () ;
+
+   for (i=0; i<64; i++)
+      __sync_fetch_and_add (&soma, dados[i]) ;
+
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   task_attr_t attr = { .stack_size = 0 } ;
+   unsigned int start, elapsed ;
+   long i, trocas ;
+
+   attr.copy_stack = argc > 1 && !strcmp (argv[1], "shared") ;
+
+   printf ("main: inicio (pilha %s)\n", attr.copy_stack ? "compartilhada" : "própria");
+
+   ppos_init () ;
+
+   for (i=0; i<NUMTASKS; i++)
+      if (task_create_ex (&task[i], &attr, Body, (void *) i) < 0)
+      {
+         printf ("main: ERRO ao criar a tarefa %ld\n", i) ;
+         exit (1) ;
+      }
+
+   start = systime () ;
+
+   for (i=0; i<NUMTASKS; i++)
+      task_join (&task[i]) ;
+
+   elapsed = systime () - start ;
+   trocas = (long) NUMTASKS * (ROUNDS + 1) ;
+
+   if (soma != 64L * NUMTASKS * (NUMTASKS-1) / 2)
+      printf ("main: ERRO: soma %ld\n", soma) ;
+
+   printf ("main: %ld trocas em %u ms (%ld ns/troca)\n", trocas, elapsed,
+           trocas ? elapsed * 1000000L / trocas : 0) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
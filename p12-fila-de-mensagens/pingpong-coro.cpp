@@ -0,0 +1,245 @@
+// PingPongOS - PingPong Operating System
+
+// Teste das corrotinas C++20 (ppos_coro.hpp) - uma corrotina e uma tarefa
+// se alternam por semáforos; uma corrotina repassa as mensagens de uma
+// tarefa produtora a uma tarefa consumidora por filas de mensagens; uma
+// corrotina dorme; uma corrotina calcula fib() com corrotinas aninhadas e
+// aguarda outra corrotina iniciada; por fim, NUMCORO corrotinas e NUMCORO
+// tarefas cedem o processador ROUNDS vezes cada, para comparar o custo.
+//
+// Compilar com:
+// gcc -Wall -c ppos_*.c queue.c
+// g++ -std=c++20 -Wall -o pingpong-coro pingpong-coro.cpp ppos_*.o queue.o
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include "ppos_coro.hpp"
+
+#define NUMVALUES 1000
+#define NUMCORO   500
+#define ROUNDS    10
+#define FIB       15
+
+semaphore_t s_ping, s_pong ;
+mqueue_t q_entrada, q_saida ;
+task_t ping, prod, cons ;
+long soma = 0, contador = 0 ;
+size_t ultimo = 0 ;     // tamanho da última alocação (quadro da corrotina)
+
+// registra o tamanho dos quadros alocados para as corrotinas
+void *operator new (size_t size)
+{
+   void *p = malloc (size) ;
+
+   if (p == NULL)
+      throw std::bad_alloc () ;
+   ultimo = size ;
+   return (p) ;
+}
+
+void operator delete (void *p) noexcept
+{
+   free (p) ;
+}
+
+void operator delete (void *p, size_t size) noexcept
+{
+   free (p) ;
+}
+
+// ping-pong entre uma corrotina e uma tarefa ================================
+
+ppos::task<> Pong ()
+{
+   int i ;
+
+   for (i=0; i<5; i++)
+   {
+      co_await ppos::sem_down (&s_pong) ;
+      printf ("   corrotina: pong %d\n", i) ;
+      sem_up (&s_ping) ;
+   }
+}
+
+void pingBody (void *arg)
+{
+   int i ;
+
+   for (i=0; i<5; i++)
+   {
+      printf ("   tarefa:    ping %d\n", i) ;
+      sem_up (&s_pong) ;
+      sem_down (&s_ping) ;
+   }
+   task_exit (0) ;
+}
+
+// filas de mensagens entre tarefas, passando por uma corrotina ==============
+
+void prodBody (void *arg)
+{
+   long i ;
+
+   for (i=0; i<NUMVALUES; i++)
+      mqueue_send (&q_entrada, &i) ;
+   task_exit (0) ;
+}
+
+ppos::task<long> Repassa ()
+{
+   long i, v, total = 0 ;
+
+   for (i=0; i<NUMVALUES; i++)
+   {
+      co_await ppos::mqueue_recv (&q_entrada, &v) ;
+      total += v ;
+      v = v * 2 ;
+      co_await ppos::mqueue_send (&q_saida, &v) ;
+   }
+   co_return total ;
+}
+
+void consBody (void *arg)
+{
+   long i, v ;
+
+   for (i=0; i<NUMVALUES; i++)
+   {
+      mqueue_recv (&q_saida, &v) ;
+      soma += v ;
+   }
+   task_exit (0) ;
+}
+
+// sono, corrotinas aninhadas e join =========================================
+
+ppos::task<> Dorme (int t)
+{
+   unsigned int start = systime () ;
+
+   co_await ppos::task_sleep (t) ;
+   printf ("   corrotina: dormiu %u ms (pedido %d ms)\n", systime () - start, t) ;
+}
+
+// cada chamada executa dentro da corrotina que a aguarda
+ppos::task<long> Fib (long n)
+{
+   if (n < 2)
+      co_return n ;
+   co_return co_await Fib (n-1) + co_await Fib (n-2) ;
+}
+
+ppos::task<long> Calcula ()
+{
+   ppos::task<> dorme = Dorme (50) ;
+   long f ;
+
+   dorme.start () ;
+   f = co_await Fib (FIB) ;
+   co_await dorme ;
+   co_return f ;
+}
+
+// custo de NUMCORO corrotinas e de NUMCORO tarefas ==========================
+
+ppos::task<> Cede ()
+{
+   int i ;
+
+   for (i=0; i<ROUNDS; i++)
+   {
+      __sync_fetch_and_add (&contador, 1) ;
+      co_await ppos::task_yield () ;
+   }
+}
+
+void cedeBody (void *arg)
+{
+   int i ;
+
+   for (i=0; i<ROUNDS; i++)
+   {
+      __sync_fetch_and_add (&contador, 1) ;
+      task_yield () ;
+   }
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   std::vector<ppos::task<>> cede ;
+   static task_t tarefas[NUMCORO] ;
+   long i, total, esperado ;
+   size_t quadro ;
+   unsigned int start ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   // ping-pong
+   sem_create (&s_ping, 0) ;
+   sem_create (&s_pong, 0) ;
+   ppos::task<> pong = Pong () ;
+   pong.start () ;
+   task_create (&ping, pingBody, NULL) ;
+   task_join (&ping) ;
+   pong.join () ;
+   sem_destroy (&s_ping) ;
+   sem_destroy (&s_pong) ;
+
+   // filas
+   mqueue_create (&q_entrada, 5, sizeof (long)) ;
+   mqueue_create (&q_saida, 5, sizeof (long)) ;
+   ppos::task<long> repassa = Repassa () ;
+   quadro = ultimo ;
+   repassa.start () ;
+   task_create (&prod, prodBody, NULL) ;
+   task_create (&cons, consBody, NULL) ;
+   total = repassa.join () ;
+   task_join (&prod) ;
+   task_join (&cons) ;
+   mqueue_destroy (&q_entrada) ;
+   mqueue_destroy (&q_saida) ;
+
+   esperado = (long) NUMVALUES * (NUMVALUES-1) / 2 ;
+   printf ("main: repassados %ld, recebidos %ld (quadro de %zu bytes)\n", total, soma, quadro) ;
+   if (total != esperado || soma != 2 * esperado)
+      printf ("main: ERRO: soma %ld/%ld, esperado %ld\n", total, soma, esperado) ;
+
+   // corrotinas aninhadas
+   ppos::task<long> calcula = Calcula () ;
+   calcula.start () ;
+   printf ("main: fib(%d) = %ld\n", FIB, calcula.join ()) ;
+
+   // custo
+   contador = 0 ;
+   start = systime () ;
+   cede.reserve (NUMCORO) ;
+   for (i=0; i<NUMCORO; i++)
+   {
+      cede.push_back (Cede ()) ;
+      cede.back ().start () ;
+   }
+   quadro = ultimo ;
+   for (i=0; i<NUMCORO; i++)
+      cede[i].join () ;
+   printf ("main: %d corrotinas, %ld trocas em %u ms (quadro de %zu bytes)\n",
+           NUMCORO, contador, systime () - start, quadro) ;
+
+   contador = 0 ;
+   start = systime () ;
+   for (i=0; i<NUMCORO; i++)
+      task_create (&tarefas[i], cedeBody, NULL) ;
+   for (i=0; i<NUMCORO; i++)
+      task_join (&tarefas[i]) ;
+   printf ("main: %d tarefas,    %ld trocas em %u ms (pilha de %d bytes)\n",
+           NUMCORO, contador, systime () - start, STACKSIZE) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,160 @@
+// PingPongOS - PingPong Operating System
+
+// Teste das micro-tarefas - a main agenda NUMCALLS micro-tarefas e aguarda
+// a última em um semáforo; depois, uma micro-tarefa que se reagenda NUMCALLS
+// vezes; para comparar, os mesmos NUMCALLS trabalhos em um pool de tarefas.
+// Por fim, uma cadeia de micro-tarefas executa por CHAIN ms enquanto uma
+// tarefa comum conta, e a tarefa deve receber o processador mesmo assim.
+// Por fim, uma micro-tarefa chama operações bloqueantes, que devem retornar
+// -1 sem bloquear, e task_exit, que deve retornar sem encerrar o dispatcher.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define NUMCALLS 2000000
+#define CHAIN    200
+
+long contador = 0 ;
+long voltas = 0 ;
+int  fim_cadeia = 0 ;
+unsigned int limite ;
+semaphore_t s_fim ;
+task_pool_t pool ;
+task_t conta ;
+
+// micro-tarefa simples: a última libera a main
+void Incrementa (void *arg)
+{
+   if (++contador == NUMCALLS)
+      sem_up (&s_fim) ;
+}
+
+// micro-tarefa que se reagenda até NUMCALLS chamadas
+void Reagenda (void *arg)
+{
+   if (++contador == NUMCALLS)
+      sem_up (&s_fim) ;
+   else
+      ppos_defer (Reagenda, NULL) ;
+}
+
+// trabalho do pool
+void Trabalho (void *arg)
+{
+   __sync_fetch_and_add (&contador, 1) ;
+}
+
+// cadeia de micro-tarefas que executa até o limite de tempo
+void Cadeia (void *arg)
+{
+   voltas++ ;
+   if (systime () < limite)
+      ppos_defer (Cadeia, NULL) ;
+   else
+      fim_cadeia = 1 ;
+}
+
+// tarefa comum que conta enquanto a cadeia executa
+void contaBody (void *arg)
+{
+   long n = 0 ;
+
+   while (!fim_cadeia)
+   {
+      n++ ;
+      if (n % 1000 == 0)
+         task_yield () ;
+   }
+   printf ("   tarefa: contou %ld durante a cadeia\n", n) ;
+   task_exit (0) ;
+}
+
+// corpo do laço paralelo, que não deve executar
+void Parte (long begin, long end, void *ctx)
+{
+   printf ("   micro-tarefa: ERRO: laço paralelo executado\n") ;
+}
+
+// micro-tarefa que tenta bloquear
+void Bloqueia (void *arg)
+{
+   int r1, r2, r3, r4 ;
+
+   r1 = task_yield () ;
+   r2 = sem_down (&s_fim) ;
+   r3 = task_sleep (10) ;
+   r4 = task_parallel_for (0, 1000, 1, Parte, NULL) ;
+   printf ("   micro-tarefa: task_yield %d, sem_down %d, task_sleep %d, task_parallel_for %d\n",
+           r1, r2, r3, r4) ;
+   if (r1 != -1 || r2 != -1 || r3 != -1 || r4 != -1)
+      printf ("   micro-tarefa: ERRO: uma operação bloqueante não retornou -1\n") ;
+   sem_up (&s_fim) ;
+   task_exit (0) ;
+}
+
+// imprime a vazão de um modo
+void mede (char *modo, unsigned int start)
+{
+   unsigned int elapsed = systime () - start ;
+
+   printf ("main: %-12s %ld chamadas em %4u ms (%ld chamadas/s)\n", modo, contador,
+           elapsed, elapsed ? contador * 1000L / elapsed : 0) ;
+   if (contador != NUMCALLS)
+      printf ("main: ERRO: %ld chamadas, esperado %d\n", contador, NUMCALLS) ;
+}
+
+int main (int argc, char *argv[])
+{
+   long i ;
+   unsigned int start ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   sem_create (&s_fim, 0) ;
+
+   // agendadas pela main
+   contador = 0 ;
+   start = systime () ;
+   for (i=0; i<NUMCALLS; i++)
+      ppos_defer (Incrementa, NULL) ;
+   sem_down (&s_fim) ;
+   mede ("agendadas", start) ;
+
+   // encadeadas
+   contador = 0 ;
+   start = systime () ;
+   ppos_defer (Reagenda, NULL) ;
+   sem_down (&s_fim) ;
+   mede ("encadeadas", start) ;
+
+   // pool de tarefas
+   contador = 0 ;
+   start = systime () ;
+   task_pool_create (&pool, 1) ;
+   for (i=0; i<NUMCALLS; i++)
+      task_pool_submit (&pool, Trabalho, NULL, 0) ;
+   task_pool_wait (&pool) ;
+   mede ("pool", start) ;
+   task_pool_destroy (&pool) ;
+
+   // cadeia concorrendo com uma tarefa
+   limite = systime () + CHAIN ;
+   task_create (&conta, contaBody, NULL) ;
+   ppos_defer (Cadeia, NULL) ;
+   task_join (&conta) ;
+   printf ("main: cadeia de %ld micro-tarefas em %d ms\n", voltas, CHAIN) ;
+
+   // operações bloqueantes em uma micro-tarefa
+   ppos_defer (Bloqueia, NULL) ;
+   sem_down (&s_fim) ;
+
+   sem_destroy (&s_fim) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,60 @@
+// PingPongOS - PingPong Operating System
+
+// Medida do custo de escalonamento com muitas tarefas prontas - NUMTASKS
+// tarefas alternam o processador com task_yield, de forma que cada troca
+// percorre a fila de prontas e os descritores de tarefas diferentes. A
+// política pode ser escolhida pela variável de ambiente PPOS_SCHED, entre
+// prio e rr: nas políticas por tempo virtual, a tarefa que cede o
+// processador antes do fim de um tick continua a primeira da fila.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define NUMTASKS 10000
+#define ROUNDS   50
+
+task_t task[NUMTASKS] ;
+
+// corpo das threads
+void Body (void * arg)
+{
+   int i ;
+
+   for (i=0; i<ROUNDS; i++)
+      task_yield () ;
+
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   unsigned int start, elapsed ;
+   long i, trocas ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   for (i=0; i<NUMTASKS; i++)
+      task_create (&task[i], Body, NULL) ;
+
+   // a primeira rodada aloca as pilhas, fora da medida
+   task_yield () ;
+
+   start = systime () ;
+
+   for (i=0; i<NUMTASKS; i++)
+      task_join (&task[i]) ;
+
+   elapsed = systime () - start ;
+   trocas = (long) NUMTASKS * ROUNDS ;
+
+   printf ("main: %d tarefas, %ld trocas em %u ms (%ld ns/troca)\n", NUMTASKS,
+           trocas, elapsed, trocas ? elapsed * 1000000L / trocas : 0) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,103 @@
+// PingPongOS - PingPong Operating System
+
+// Teste do escalonamento de tempo real (EDF) - tarefas periódicas com prazos
+// disputam o processador com tarefas normais que nunca liberam a CPU; com
+// utilização total de 60%, nenhuma ativação deve perder o prazo
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define DURATION 2000
+
+typedef struct
+{
+   char *name ;
+   int period ;
+   int cost ;
+} rt_param_t ;
+
+task_t rt[3], hog[2] ;
+long loops_per_ms ;
+rt_param_t param[3] = {{"    RT50",  50, 10},
+                       {"        RT100", 100, 20},
+                       {"            RT200", 200, 40}} ;
+
+// executa n iterações vazias
+void spin (long n)
+{
+   volatile long i ;
+   for (i = 0; i < n; i++) ;
+}
+
+// consome ms milissegundos de processamento
+void busy (int ms)
+{
+   spin (ms * loops_per_ms) ;
+}
+
+// mede quantas iterações de spin cabem em um milissegundo
+void calibrate ()
+{
+   long n = 0 ;
+   unsigned int start = systime() ;
+
+   while (systime() < start + 100)
+   {
+      spin (1000) ;
+      n += 1000 ;
+   }
+   loops_per_ms = n / 100 ;
+}
+
+// corpo das tarefas periódicas
+void RtBody (void * arg)
+{
+   rt_param_t *p = (rt_param_t *) arg ;
+   int job ;
+
+   task_setdeadline (NULL, p->period, p->period) ;
+
+   for (job = 0; job < DURATION / p->period; job++)
+   {
+      busy (p->cost) ;
+      task_waitperiod () ;
+   }
+   printf ("%s: fim em %4d ms\n", p->name, systime()) ;
+   task_exit (0) ;
+}
+
+// corpo das tarefas normais
+void HogBody (void * arg)
+{
+   unsigned int start = systime() ;
+   while (systime() < start + DURATION) ;
+   printf ("%s: fim em %4d ms\n", (char *) arg, systime()) ;
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   int i ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+   calibrate () ;
+
+   task_create (&hog[0], HogBody, "                Hog1") ;
+   task_create (&hog[1], HogBody, "                    Hog2") ;
+
+   for (i=0; i<3; i++)
+      task_create (&rt[i], RtBody, &param[i]) ;
+
+   for (i=0; i<3; i++)
+      task_join (&rt[i]) ;
+   for (i=0; i<2; i++)
+      task_join (&hog[i]) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
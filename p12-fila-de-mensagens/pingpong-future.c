@@ -0,0 +1,163 @@
+// PingPongOS - PingPong Operating System
+
+// Teste dos futuros - fib(n) recursivo em que cada chamada cria uma tarefa
+// com task_async para fib(n-1) e aguarda o seu valor com future_get, medindo
+// o custo de uma criação seguida de uma espera; depois, uma cadeia de
+// continuações (future_then), NWAIT tarefas aguardando o mesmo futuro, que a
+// primeira a recebê-lo destroi, e uma promessa definida por outra tarefa com
+// um valor copiado para dentro do futuro.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define FIB   20
+#define NWAIT 8
+
+typedef struct
+{
+   int x, y ;
+   char nome[16] ;
+} ponto_t ;
+
+task_t produtor, espera[NWAIT] ;
+future_t promessa, *comum ;
+int destruido = 0, erros = 0 ;
+
+// fib(n) com uma tarefa para fib(n-1) e fib(n-2) na tarefa corrente
+void *Fib (void *arg)
+{
+   long n = (long) arg ;
+   long a, b ;
+   future_t *f ;
+
+   if (n < 2)
+      return (void *) n ;
+
+   f = task_async (Fib, (void *) (n-1)) ;
+   b = (long) Fib ((void *) (n-2)) ;
+   a = (long) future_get (f) ;
+   future_destroy (f) ;
+
+   return (void *) (a + b) ;
+}
+
+void *Quadrado (void *value, void *arg)
+{
+   return (void *) ((long) value * (long) value) ;
+}
+
+void *Soma (void *value, void *arg)
+{
+   return (void *) ((long) value + (long) arg) ;
+}
+
+void *Dobro (void *value, void *arg)
+{
+   return (void *) ((long) value * 2) ;
+}
+
+void *Sete (void *arg)
+{
+   task_sleep (10) ;
+   return (void *) 7L ;
+}
+
+// aguarda o futuro comum; a primeira tarefa a recebê-lo o destroi, e as
+// demais recebem o valor ou NULL
+void Espera (void *arg)
+{
+   long v = (long) future_get (comum) ;
+
+   if (v != 7 && v != 0)
+      __sync_fetch_and_add (&erros, 1) ;
+   if (__sync_bool_compare_and_swap (&destruido, 0, 1))
+      future_destroy (comum) ;
+   task_exit (0) ;
+}
+
+// define a promessa com uma cópia de uma variável local
+void Produtor (void *arg)
+{
+   ponto_t p = { 3, 4, "ponto" } ;
+
+   task_sleep (20) ;
+   printf ("%5d ms: produtor define a promessa\n", systime ()) ;
+   future_set_blob (&promessa, &p, sizeof (p)) ;
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   long i, r, tarefas, a, b, t ;
+   unsigned int start, elapsed ;
+   future_t *f, *g[3] ;
+   ponto_t *p ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   // fib: cada chamada com n >= 2 cria uma tarefa
+   start = systime () ;
+   r = (long) Fib ((void *) FIB) ;
+   elapsed = systime () - start ;
+
+   // fib(n) cria fib(n+1) - 1 tarefas
+   for (a = 0, b = 1, i = 1; i <= FIB; i++)
+   {
+      t = a + b ; a = b ; b = t ;
+   }
+   tarefas = b - 1 ;
+
+   printf ("main: fib(%d) = %ld, %ld tarefas em %u ms (%ld ns por criacao e espera)\n",
+           FIB, r, tarefas, elapsed,
+           tarefas ? elapsed * 1000000L / tarefas : 0) ;
+   if (r != 6765)
+      printf ("main: ERRO: fib(%d) = %ld\n", FIB, r) ;
+
+   // continuações: ((7^2) + 1) * 2 = 100, executadas pela tarefa de Sete
+   f = task_async (Sete, NULL) ;
+   g[0] = future_then (f, Quadrado, NULL) ;
+   g[1] = future_then (g[0], Soma, (void *) 1L) ;
+   g[2] = future_then (g[1], Dobro, NULL) ;
+
+   r = (long) future_get (g[2]) ;
+   printf ("main: cadeia de continuacoes = %ld\n", r) ;
+   if (r != 100)
+      printf ("main: ERRO: cadeia = %ld\n", r) ;
+
+   // com o valor definido, a continuação executa na hora
+   future_destroy (g[2]) ;
+   g[2] = future_then (g[1], Dobro, NULL) ;
+   printf ("main: continuacao tardia pronta: %d, valor %ld\n",
+           future_ready (g[2]), (long) future_get (g[2])) ;
+
+   future_destroy (f) ;
+   for (i = 0; i < 3; i++)
+      future_destroy (g[i]) ;
+
+   // várias tarefas aguardando o mesmo futuro, destruído pela primeira
+   comum = task_async (Sete, NULL) ;
+   for (i = 0; i < NWAIT; i++)
+      task_create (&espera[i], Espera, NULL) ;
+   for (i = 0; i < NWAIT; i++)
+      task_join (&espera[i]) ;
+   printf ("main: %d tarefas aguardaram o mesmo futuro\n", NWAIT) ;
+   if (erros)
+      printf ("main: ERRO: %d valores invalidos\n", erros) ;
+
+   // promessa com valor copiado para dentro do futuro
+   future_create (&promessa) ;
+   task_create (&produtor, Produtor, NULL) ;
+   printf ("%5d ms: main aguarda a promessa\n", systime ()) ;
+   p = future_get (&promessa) ;
+   printf ("%5d ms: main recebeu %s (%d, %d)\n", systime (), p->nome, p->x, p->y) ;
+   task_join (&produtor) ;
+   future_destroy (&promessa) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
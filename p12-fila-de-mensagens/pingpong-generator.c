@@ -0,0 +1,107 @@
+// PingPongOS - PingPong Operating System
+
+// Teste dos geradores - um gerador produz os números de 0 a NUMVALUES-1 e a
+// main os soma, com as duas tarefas trocando o processador diretamente a
+// cada valor; depois, o mesmo par produtor/consumidor com uma fila de
+// mensagens, como prodBody/somaBody em pingpong-mqueue.c, com filas de 1 e
+// de QUEUESIZE mensagens. Por fim, um gerador destruído antes do fim.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define NUMVALUES 200000
+#define QUEUESIZE 64
+
+generator_t gen ;
+task_t prod ;
+mqueue_t queue ;
+
+// produz os números de 0 a n-1
+void Contador (void * arg)
+{
+   long n = (long) arg ;
+   long i ;
+
+   for (i=0; i<n; i++)
+      if (task_yield_value (&i) < 0)
+      {
+         printf ("gerador: destruido em %ld\n", i) ;
+         return ;
+      }
+}
+
+// produtor com fila de mensagens
+void prodBody (void * arg)
+{
+   long i ;
+
+   for (i=0; i<NUMVALUES; i++)
+      mqueue_send (&queue, &i) ;
+   task_exit (0) ;
+}
+
+// imprime a vazão de um modo
+void mede (char *modo, long soma, unsigned int start)
+{
+   unsigned int elapsed = systime () - start ;
+
+   printf ("main: %-10s %d valores em %4u ms (%ld valores/s)\n", modo, NUMVALUES,
+           elapsed, elapsed ? NUMVALUES * 1000L / elapsed : 0) ;
+   if (soma != (long) NUMVALUES * (NUMVALUES-1) / 2)
+      printf ("main: ERRO: soma %ld\n", soma) ;
+}
+
+// consome os valores de uma fila de capacidade max
+void fila (char *modo, int max)
+{
+   long i, v, soma ;
+   unsigned int start ;
+
+   start = systime () ;
+   mqueue_create (&queue, max, sizeof (long)) ;
+   task_create (&prod, prodBody, NULL) ;
+   for (soma=0, i=0; i<NUMVALUES; i++)
+   {
+      mqueue_recv (&queue, &v) ;
+      soma += v ;
+   }
+   task_join (&prod) ;
+   mqueue_destroy (&queue) ;
+   mede (modo, soma, start) ;
+}
+
+int main (int argc, char *argv[])
+{
+   long *v, soma ;
+   unsigned int start ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   // gerador
+   start = systime () ;
+   task_generator_create (&gen, Contador, (void *) NUMVALUES) ;
+   for (soma=0; (v = task_next (&gen)) != NULL; )
+      soma += *v ;
+   task_generator_destroy (&gen) ;
+   mede ("gerador", soma, start) ;
+
+   // filas de mensagens
+   fila ("fila(1)", 1) ;
+   fila ("fila(64)", QUEUESIZE) ;
+
+   // gerador abandonado pela main
+   task_generator_create (&gen, Contador, (void *) NUMVALUES) ;
+   task_next (&gen) ;
+   task_next (&gen) ;
+   v = task_next (&gen) ;
+   printf ("main: terceiro valor %ld\n", *v) ;
+   task_generator_destroy (&gen) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,98 @@
+// PingPongOS - PingPong Operating System
+
+// Teste dos laços paralelos - soma um vetor grande com laços simples, como
+// hardwork(), de três modos: na própria main, dividido à mão em uma tarefa
+// por parte aguardada com task_join, e com task_parallel_reduce, cujo
+// tamanho das partes é ajustado a cada rodada. As somas devem coincidir; com
+// várias cpus (PPOS_CPUS) os modos paralelos devem ser mais rápidos.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define SIZE     2000000
+#define WORKLOAD 8
+#define NUMTASKS 16
+#define ROUNDS   5
+
+int *vetor ;
+long parcial[NUMTASKS] ;
+task_t task[NUMTASKS] ;
+
+// soma as posições [inicio, fim) do vetor, repetindo cada soma WORKLOAD
+// vezes para simular um processamento pesado
+long soma (long inicio, long fim, void *ctx)
+{
+   long i, j, s ;
+
+   s = 0 ;
+   for (i=inicio; i<fim; i++)
+      for (j=0; j<WORKLOAD; j++)
+         s += vetor[i] ;
+   return (s) ;
+}
+
+long combina (long a, long b)
+{
+   return (a + b) ;
+}
+
+// divide o vetor entre NUMTASKS tarefas
+void Body (void * arg)
+{
+   long id = (long) arg ;
+
+   parcial[id] = soma (id * SIZE / NUMTASKS, (id+1) * SIZE / NUMTASKS, NULL) ;
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   long i, r, serial, total ;
+   unsigned int start ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   vetor = malloc (SIZE * sizeof (int)) ;
+   for (i=0; i<SIZE; i++)
+      vetor[i] = i % 1000 ;
+
+   // na main
+   start = systime () ;
+   serial = soma (0, SIZE, NULL) ;
+   printf ("main: serial     %ld em %4u ms\n", serial, systime () - start) ;
+
+   // uma tarefa por parte
+   start = systime () ;
+   for (i=0; i<NUMTASKS; i++)
+      task_create (&task[i], Body, (void *) i) ;
+   for (total=0, i=0; i<NUMTASKS; i++)
+   {
+      task_join (&task[i]) ;
+      total += parcial[i] ;
+   }
+   printf ("main: tarefas    %ld em %4u ms\n", total, systime () - start) ;
+   if (total != serial)
+      printf ("main: ERRO: soma das tarefas\n") ;
+
+   // laço paralelo, com o tamanho das partes ajustado a cada rodada
+   for (r=0; r<ROUNDS; r++)
+   {
+      start = systime () ;
+      total = 0 ;
+      task_parallel_reduce (0, SIZE, 0, soma, combina, NULL, &total) ;
+      printf ("main: paralelo   %ld em %4u ms (rodada %ld)\n", total,
+              systime () - start, r) ;
+      if (total != serial)
+         printf ("main: ERRO: soma do laco paralelo\n") ;
+   }
+
+   free (vetor) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,189 @@
+// PingPongOS - PingPong Operating System
+
+// Teste dos pipelines - dois geradores de valores, um estágio que calcula
+// quadrados com um processamento pesado, um filtro que descarta os
+// quadrados ímpares e um somador. O mesmo grafo é montado à mão, como em
+// pingpong-mqueue.c, com tarefas e filas de mensagens de um item por
+// mensagem. As somas devem coincidir; com PPOS_STATS=1, as estatísticas do
+// pipeline devem apontar o estágio dos quadrados como gargalo.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define NUMVALUES 20000
+#define WORKLOAD  3000
+#define QUEUESIZE 64
+
+long proximo = 0 ;      // próximo valor dos geradores
+long soma = 0 ;         // soma dos quadrados pares
+task_t gera[2], quad[2], filt, soma_t ;
+mqueue_t q_valores, q_quadrados, q_pares ;
+
+// simula um processamento pesado
+long hardwork (long n)
+{
+   long i, s ;
+
+   s = 0 ;
+   for (i=0; i<WORKLOAD; i++)
+      s += n ;
+   return (s / WORKLOAD) ;
+}
+
+// estágios do pipeline ======================================================
+
+int Gera (void *in, void *out, void *arg)
+{
+   long v = __sync_fetch_and_add (&proximo, 1) ;
+
+   if (v >= NUMVALUES)
+      return (0) ;
+   *(long *) out = v ;
+   return (1) ;
+}
+
+int Quadrado (void *in, void *out, void *arg)
+{
+   long v = hardwork (*(long *) in) ;
+
+   *(long *) out = v * v ;
+   return (1) ;
+}
+
+int Filtra (void *in, void *out, void *arg)
+{
+   if (*(long *) in % 2)
+      return (0) ;
+   *(long *) out = *(long *) in ;
+   return (1) ;
+}
+
+int Soma (void *in, void *out, void *arg)
+{
+   soma += *(long *) in ;
+   return (1) ;
+}
+
+// o mesmo grafo com tarefas e filas =========================================
+
+void geraBody (void *arg)
+{
+   long v ;
+
+   while ((v = __sync_fetch_and_add (&proximo, 1)) < NUMVALUES)
+      mqueue_send (&q_valores, &v) ;
+   v = -1 ;
+   mqueue_send (&q_valores, &v) ;
+   task_exit (0) ;
+}
+
+void quadBody (void *arg)
+{
+   long v ;
+
+   while (mqueue_recv (&q_valores, &v) == 0 && v >= 0)
+   {
+      v = hardwork (v) ;
+      v = v * v ;
+      mqueue_send (&q_quadrados, &v) ;
+   }
+   v = -1 ;
+   mqueue_send (&q_quadrados, &v) ;
+   task_exit (0) ;
+}
+
+void filtBody (void *arg)
+{
+   long v, fim = 0 ;
+
+   // termina depois do fim dos dois estágios de quadrados
+   while (fim < 2)
+   {
+      mqueue_recv (&q_quadrados, &v) ;
+      if (v < 0)
+         fim++ ;
+      else if (v % 2 == 0)
+         mqueue_send (&q_pares, &v) ;
+   }
+   v = -1 ;
+   mqueue_send (&q_pares, &v) ;
+   task_exit (0) ;
+}
+
+void somaBody (void *arg)
+{
+   long v ;
+
+   while (mqueue_recv (&q_pares, &v) == 0 && v >= 0)
+      soma += v ;
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   pipeline_t pipe ;
+   long i, esperado ;
+   int g, q, f, s ;
+   unsigned int start ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   for (esperado=0, i=0; i<NUMVALUES; i++)
+      if (i % 2 == 0)
+         esperado += i * i ;
+
+   // com o pipeline
+   start = systime () ;
+   pipeline_create (&pipe) ;
+   g = pipeline_stage (&pipe, "gera", Gera, NULL, sizeof (long), 2, QUEUESIZE) ;
+   q = pipeline_stage (&pipe, "quadrado", Quadrado, NULL, sizeof (long), 2, QUEUESIZE) ;
+   f = pipeline_stage (&pipe, "filtra", Filtra, NULL, sizeof (long), 1, QUEUESIZE) ;
+   s = pipeline_stage (&pipe, "soma", Soma, NULL, 0, 1, QUEUESIZE) ;
+   pipeline_connect (&pipe, g, q) ;
+   pipeline_connect (&pipe, q, f) ;
+   pipeline_connect (&pipe, f, s) ;
+   if (pipeline_connect (&pipe, s, g) == 0)
+      printf ("main: ERRO: ciclo aceito\n") ;
+   pipeline_run (&pipe) ;
+   pipeline_wait (&pipe) ;
+
+   printf ("main: pipeline soma %ld em %u ms\n", soma, systime () - start) ;
+   if (soma != esperado)
+      printf ("main: ERRO: soma do pipeline %ld, esperado %ld\n", soma, esperado) ;
+
+   // com tarefas e filas
+   proximo = soma = 0 ;
+   start = systime () ;
+   mqueue_create (&q_valores, QUEUESIZE, sizeof (long)) ;
+   mqueue_create (&q_quadrados, QUEUESIZE, sizeof (long)) ;
+   mqueue_create (&q_pares, QUEUESIZE, sizeof (long)) ;
+   for (i=0; i<2; i++)
+   {
+      task_create (&gera[i], geraBody, NULL) ;
+      task_create (&quad[i], quadBody, NULL) ;
+   }
+   task_create (&filt, filtBody, NULL) ;
+   task_create (&soma_t, somaBody, NULL) ;
+   task_join (&soma_t) ;
+   for (i=0; i<2; i++)
+   {
+      task_join (&gera[i]) ;
+      task_join (&quad[i]) ;
+   }
+   task_join (&filt) ;
+   mqueue_destroy (&q_valores) ;
+   mqueue_destroy (&q_quadrados) ;
+   mqueue_destroy (&q_pares) ;
+
+   printf ("main: filas    soma %ld em %u ms\n", soma, systime () - start) ;
+   if (soma != esperado)
+      printf ("main: ERRO: soma das filas %ld, esperado %ld\n", soma, esperado) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
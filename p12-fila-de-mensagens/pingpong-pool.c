@@ -0,0 +1,103 @@
+// PingPongOS - PingPong Operating System
+
+// Teste e medida do pool de tarefas - NUMJOBS trabalhos curtos executados
+// primeiro com uma tarefa para cada trabalho e depois por um pool de
+// WORKERS tarefas; em seguida, trabalhos longos, preemptados pelo relógio,
+// com prioridades diferentes: os de maior prioridade terminam antes. Com
+// PPOS_CPUS > 1 os trabalhos executam em paralelo.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define NUMJOBS  20000
+#define BATCH    500
+#define WORKERS  4
+#define LONGJOBS 8
+
+task_t task[BATCH] ;
+task_pool_t pool ;
+long soma = 0 ;
+int ordem = 0 ;
+int fim[LONGJOBS] ;
+
+// trabalho curto
+void Job (void * arg)
+{
+   __sync_fetch_and_add (&soma, (long) arg) ;
+}
+
+// corpo de tarefa para o mesmo trabalho
+void Body (void * arg)
+{
+   Job (arg) ;
+   task_exit (0) ;
+}
+
+// trabalho longo: vários quanta de processamento
+void LongJob (void * arg)
+{
+   long i, n = (long) arg ;
+   volatile long x = 0 ;
+
+   for (i=0; i<20000000; i++)
+      x += i ;
+
+   fim[n] = __sync_add_and_fetch (&ordem, 1) ;
+}
+
+// imprime a vazão de uma das formas de execução
+void report (char *name, unsigned int elapsed)
+{
+   printf ("main: %s: %d trabalhos em %u ms (%ld trabalhos/s)\n", name, NUMJOBS,
+           elapsed, elapsed ? NUMJOBS * 1000L / elapsed : 0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   long i, j ;
+   unsigned int start ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   // uma tarefa para cada trabalho, em lotes
+   start = systime () ;
+   for (i=0; i<NUMJOBS; i+=BATCH)
+   {
+      for (j=0; j<BATCH; j++)
+         task_create (&task[j], Body, (void *) (i+j)) ;
+      for (j=0; j<BATCH; j++)
+         task_join (&task[j]) ;
+   }
+   report ("tarefas", systime () - start) ;
+
+   // os mesmos trabalhos no pool
+   task_pool_create (&pool, WORKERS) ;
+
+   start = systime () ;
+   for (i=0; i<NUMJOBS; i++)
+      task_pool_submit (&pool, Job, (void *) i, 0) ;
+   task_pool_wait (&pool) ;
+   report ("pool", systime () - start) ;
+
+   if (soma != 2L * NUMJOBS * (NUMJOBS-1) / 2)
+      printf ("main: ERRO: soma %ld\n", soma) ;
+
+   // trabalhos longos: os de número par têm prioridade maior
+   for (i=0; i<LONGJOBS; i++)
+      task_pool_submit (&pool, LongJob, (void *) i, i % 2 ? 10 : -10) ;
+   task_pool_wait (&pool) ;
+
+   for (i=0; i<LONGJOBS; i++)
+      printf ("main: trabalho %ld (prioridade %d) terminou em %d lugar\n", i,
+              i % 2 ? 10 : -10, fim[i]) ;
+
+   task_pool_destroy (&pool) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
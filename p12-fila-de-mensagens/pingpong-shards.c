@@ -0,0 +1,95 @@
+// PingPongOS - PingPong Operating System
+
+// Teste do modo particionado - cada cpu (shard) tem um produtor, que envia
+// mensagens ao consumidor da cpu seguinte por uma fila xqueue_t, e um
+// consumidor, que soma as mensagens recebidas da cpu anterior. Como cada cpu
+// faz sempre o mesmo trabalho, a vazão total deve crescer linearmente com o
+// número de cpus reais. Uso: pingpong-shards [cpus]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define MAXSHARDS 16
+#define MSGS      200000
+#define QUEUESIZE 256
+
+task_t prod[MAXSHARDS], cons[MAXSHARDS] ;
+xqueue_t queue[MAXSHARDS] ;
+long soma[MAXSHARDS] ;
+
+// envia MSGS mensagens pela fila da sua cpu
+void produtor (void * arg)
+{
+   long id = (long) arg ;
+   int i ;
+
+   for (i=0; i<MSGS; i++)
+      xqueue_send (&queue[id], &i) ;
+
+   task_exit (0) ;
+}
+
+// recebe as MSGS mensagens produzidas na cpu anterior
+void consumidor (void * arg)
+{
+   long id = (long) arg ;
+   int i, valor ;
+
+   for (i=0; i<MSGS; i++)
+   {
+      xqueue_recv (&queue[id], &valor) ;
+      soma[id] += valor ;
+   }
+
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   long i, shards = 2 ;
+   unsigned int start, elapsed ;
+
+   if (argc > 1)
+      shards = atoi (argv[1]) ;
+
+   if (shards < 1 || shards > MAXSHARDS)
+   {
+      fprintf (stderr, "uso: %s [cpus de 1 a %d]\n", argv[0], MAXSHARDS) ;
+      exit (1) ;
+   }
+
+   printf ("main: inicio (%ld cpus)\n", shards);
+
+   ppos_init_shards (shards) ;
+
+   start = systime () ;
+
+   for (i=0; i<shards; i++)
+   {
+      xqueue_create (&queue[i], QUEUESIZE, sizeof (int)) ;
+      task_create_on (&prod[i], i, produtor, (void *) i) ;
+      task_create_on (&cons[i], (i+1) % shards, consumidor, (void *) i) ;
+   }
+
+   for (i=0; i<shards; i++)
+   {
+      task_join (&prod[i]) ;
+      task_join (&cons[i]) ;
+
+      if (soma[i] != (long) MSGS * (MSGS-1) / 2)
+         printf ("main: ERRO na fila %ld: soma %ld\n", i, soma[i]) ;
+
+      xqueue_destroy (&queue[i]) ;
+   }
+
+   elapsed = systime () - start ;
+
+   printf ("main: %ld mensagens em %u ms (%ld mensagens/s)\n", shards * MSGS,
+           elapsed, elapsed ? shards * MSGS * 1000L / elapsed : 0) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,77 @@
+// PingPongOS - PingPong Operating System
+
+// Teste da execução em várias cpus - tarefas de processamento pesado
+// atualizam um contador compartilhado protegido por semáforo; o número de
+// cpus é dado pela variável de ambiente PPOS_CPUS. O contador final deve ser
+// sempre o mesmo e o tempo total deve cair com o número de cpus reais.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define WORKLOAD 2000
+#define NUMTASKS 16
+#define ROUNDS   10
+
+task_t task[NUMTASKS] ;
+semaphore_t s ;
+long total = 0 ;
+
+// simula um processamento pesado
+int hardwork (int n)
+{
+   int i, j, soma ;
+
+   soma = 0 ;
+   for (i=0; i<n; i++)
+      for (j=0; j<n; j++)
+         soma += j ;
+   return (soma) ;
+}
+
+// corpo das threads
+void Body (void * arg)
+{
+   int i ;
+
+   for (i=0; i<ROUNDS; i++)
+   {
+      hardwork (WORKLOAD) ;
+
+      sem_down (&s) ;
+      total += hardwork (10) ;
+      sem_up (&s) ;
+
+      task_yield () ;
+   }
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   int i ;
+   unsigned int start ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   sem_create (&s, 1) ;
+   start = systime () ;
+
+   for (i=0; i<NUMTASKS; i++)
+      task_create (&task[i], Body, NULL) ;
+
+   for (i=0; i<NUMTASKS; i++)
+      task_join (&task[i]) ;
+
+   printf ("main: total %ld (esperado %ld), %u ms\n", total,
+           (long) NUMTASKS * ROUNDS * hardwork (10), systime () - start) ;
+
+   sem_destroy (&s) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,76 @@
+// PingPongOS - PingPong Operating System
+
+// Medida da vazão de criação e encerramento de tarefas - a cada rodada a
+// main cria NUMTASKS tarefas curtas, como no teste de stress da preempção,
+// e aguarda o seu término. Executar com PPOS_STACK_POOL=0 para comparar com
+// a alocação de uma pilha nova para cada tarefa. Com o argumento "spawn" os
+// descritores são alocados pelo núcleo (task_spawn) e com "slab" cada rodada
+// cria as suas tarefas com uma única alocação (task_spawn_n).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ppos.h"
+
+#define NUMTASKS 500
+#define ROUNDS   100
+
+task_t task[NUMTASKS] ;
+task_t *spawned[NUMTASKS] ;
+void *args[NUMTASKS] ;
+long soma = 0 ;
+
+// corpo das threads
+void Body (void * arg)
+{
+   __sync_fetch_and_add (&soma, (long) arg) ;
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   long i, r ;
+   unsigned int start, elapsed ;
+   char *mode = argc > 1 ? argv[1] : "create" ;
+
+   printf ("main: inicio (%s)\n", mode);
+
+   ppos_init () ;
+
+   for (i=0; i<NUMTASKS; i++)
+      args[i] = (void *) i ;
+
+   start = systime () ;
+
+   for (r=0; r<ROUNDS; r++)
+   {
+      if (!strcmp (mode, "slab"))
+         task_spawn_n (spawned, NUMTASKS, Body, args) ;
+      else if (!strcmp (mode, "spawn"))
+         for (i=0; i<NUMTASKS; i++)
+            spawned[i] = task_spawn (Body, args[i]) ;
+      else
+         for (i=0; i<NUMTASKS; i++)
+         {
+            task_create (&task[i], Body, args[i]) ;
+            spawned[i] = &task[i] ;
+         }
+
+      for (i=0; i<NUMTASKS; i++)
+         task_join (spawned[i]) ;
+   }
+
+   elapsed = systime () - start ;
+
+   if (soma != (long) ROUNDS * NUMTASKS * (NUMTASKS-1) / 2)
+      printf ("main: ERRO: soma %ld\n", soma) ;
+
+   printf ("main: %d tarefas criadas e encerradas em %u ms (%ld tarefas/s)\n",
+           ROUNDS * NUMTASKS, elapsed,
+           elapsed ? ROUNDS * NUMTASKS * 1000L / elapsed : 0) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,67 @@
+// PingPongOS - PingPong Operating System
+
+// Teste das pilhas por tarefa - muitas tarefas pequenas, com pilhas de 16 KB,
+// convivem com uma tarefa de recursão profunda, com pilha de 1 MB. As pilhas
+// são reservadas apenas quando cada tarefa executa pela primeira vez.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define NUMTASKS 10000
+#define DEPTH    4000
+
+task_t task[NUMTASKS], deep ;
+long soma = 0 ;
+
+// corpo das tarefas pequenas
+void Body (void * arg)
+{
+   task_yield () ;
+   soma += (long) arg ;
+   task_exit (0) ;
+}
+
+// cada nível ocupa cerca de 128 bytes da pilha
+long recursao (long n)
+{
+   volatile char frame[100] ;
+
+   frame[0] = 1 ;
+   return n ? frame[0] + recursao (n-1) : 0 ;
+}
+
+void BodyDeep (void * arg)
+{
+   printf ("%s: recursao %ld\n", "deep", recursao (DEPTH)) ;
+   task_exit (0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   task_attr_t small = { .stack_size = 16384 } ;
+   task_attr_t large = { .stack_size = 1024 * 1024, .prio = -10, .name = "deep" } ;
+   long i ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   task_create_ex (&deep, &large, BodyDeep, NULL) ;
+
+   for (i=0; i<NUMTASKS; i++)
+      task_create_ex (&task[i], &small, Body, (void *) i) ;
+
+   task_join (&deep) ;
+
+   for (i=0; i<NUMTASKS; i++)
+      task_join (&task[i]) ;
+
+   printf ("main: soma %ld (esperado %ld)\n", soma,
+           (long) NUMTASKS * (NUMTASKS-1) / 2) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -0,0 +1,104 @@
+// PingPongOS - PingPong Operating System
+
+// Medida do custo da troca de contexto - duas tarefas alternam o processador
+// com task_yield e depois por um par de semáforos; em ambos os casos cada
+// passagem do processador é uma troca direta de tarefa para tarefa, sem
+// passar pelo dispatcher (veja as ativações impressas ao final de cada
+// tarefa). Compilar com -DPPOS_SWAPCONTEXT para comparar com a troca por
+// swapcontext.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ppos.h"
+
+#define YIELDS 500000
+#define ROUNDS 250000
+
+task_t Ping, Pong ;
+semaphore_t s_ping, s_pong ;
+
+// alterna o processador com task_yield
+void BodyYield (void * arg)
+{
+   int i ;
+
+   for (i=0; i<YIELDS; i++)
+      task_yield () ;
+
+   task_exit (0) ;
+}
+
+// cada rodada passa o processador para a outra tarefa e o recebe de volta
+void BodyPing (void * arg)
+{
+   int i ;
+
+   for (i=0; i<ROUNDS; i++)
+   {
+      sem_up (&s_pong) ;
+      sem_down (&s_ping) ;
+   }
+
+   task_exit (0) ;
+}
+
+void BodyPong (void * arg)
+{
+   int i ;
+
+   for (i=0; i<ROUNDS; i++)
+   {
+      sem_down (&s_pong) ;
+      sem_up (&s_ping) ;
+   }
+
+   task_exit (0) ;
+}
+
+// imprime a vazão e a latência de cada troca
+void report (char *name, long switches, unsigned int elapsed)
+{
+   printf ("main: %s: %ld trocas de contexto em %u ms (%ld trocas/s, %ld ns/troca)\n",
+           name, switches, elapsed, elapsed ? switches * 1000 / elapsed : 0,
+           switches ? elapsed * 1000000L / switches : 0) ;
+}
+
+int main (int argc, char *argv[])
+{
+   unsigned int start ;
+
+   printf ("main: inicio\n");
+
+   ppos_init () ;
+
+   task_create (&Ping, BodyYield, NULL) ;
+   task_create (&Pong, BodyYield, NULL) ;
+
+   start = systime () ;
+
+   task_join (&Ping) ;
+   task_join (&Pong) ;
+
+   report ("yield", 2L * YIELDS, systime () - start) ;
+
+   sem_create (&s_ping, 0) ;
+   sem_create (&s_pong, 0) ;
+
+   task_create (&Ping, BodyPing, NULL) ;
+   task_create (&Pong, BodyPong, NULL) ;
+
+   start = systime () ;
+
+   task_join (&Ping) ;
+   task_join (&Pong) ;
+
+   report ("semaforo", 2L * ROUNDS, systime () - start) ;
+
+   sem_destroy (&s_ping) ;
+   sem_destroy (&s_pong) ;
+
+   printf ("main: fim\n");
+   task_exit (0) ;
+
+   exit (0);
+}
@@ -11,8 +11,11 @@
 
 // macros importantes ==========================================================
 
-// habilita compatibilidade POSIX no MacOS X (para ucontext.h)
+// habilita compatibilidade POSIX no MacOS X (para ucontext.h); em C++ a
+// biblioteca padrão já a define
+#ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 600
+#endif
 
 // este código deve ser compilado em sistemas UNIX-like
 #if defined(_WIN32) || (!defined(__unix__) && !defined(__unix) && (!defined(__APPLE__) || !defined(__MACH__)))
@@ -26,9 +29,39 @@
 
 // funções gerais ==============================================================
 
-// Inicializa o sistema operacional; deve ser chamada no inicio do main()
+// Inicializa o sistema operacional; deve ser chamada no inicio do main().
+// Com a variável de ambiente PPOS_TICKLESS=1 (e uma única cpu), o relógio é
+// lido de um relógio monotônico e o temporizador dispara apenas no próximo
+// evento (fim do quantum ou despertar de uma tarefa), em vez de a cada 1 ms.
+// PPOS_STACK_POOL define quantas pilhas livres de cada tamanho são guardadas
+// para reutilização pelas próximas tarefas (padrão STACK_POOL, 0 desativa).
+// Com PPOS_STACK_CHECK=1, o uso máximo da pilha de cada tarefa é medido e
+// impresso no seu encerramento, com um resumo no encerramento do sistema.
+// Com PPOS_STATS=1, o encerramento do sistema, dos pools de tarefas e dos
+// pipelines imprime relatórios de uso (ociosidade, pilhas, filas, laços
+// paralelos e micro-tarefas). Com uma cpu, a memória livre das pilhas das
+// tarefas bloqueadas há mais de PPOS_STACK_RECLAIM ms (padrão RECLAIM_DELAY,
+// 0 desativa) é devolvida ao sistema quando a cpu fica ociosa.
 void ppos_init () ;
 
+// Inicializa o sistema operacional com a política de escalonamento indicada
+// (POLICY_PRIO, a padrão, POLICY_FAIR, POLICY_RR ou POLICY_STRIDE); substitui
+// a chamada a ppos_init(), que usa a política indicada pela variável de
+// ambiente PPOS_SCHED ("prio", "fair", "rr" ou "stride"), se definida
+void ppos_init_policy (sched_policy_t policy) ;
+
+// Inicializa o sistema operacional com as tarefas distribuídas entre cpus
+// threads do sistema, cada uma com a sua própria fila de prontas; uma cpu
+// ociosa rouba tarefas das demais. Com mais de uma cpu a política de
+// escalonamento é circular e as tarefas de tempo real não são suportadas.
+// ppos_init() usa o número de cpus indicado pela variável PPOS_CPUS (padrão 1)
+void ppos_init_smp (int cpus) ;
+
+// Inicializa o sistema operacional particionado em shards cpus independentes:
+// as tarefas nunca migram entre cpus e tarefas de cpus diferentes devem se
+// comunicar apenas por filas xqueue_t
+void ppos_init_shards (int shards) ;
+
 // gerência de tarefas =========================================================
 
 // Cria uma nova tarefa. Retorna um ID> 0 ou erro.
@@ -36,6 +69,48 @@ int task_create (task_t *task,			// descritor da nova tarefa
                  void (*start_func)(void *),	// funcao corpo da tarefa
                  void *arg) ;			// argumentos para a tarefa
 
+// Cria uma nova tarefa na cpu indicada (de 0 a cpus-1). Retorna um ID> 0 ou
+// erro.
+int task_create_on (task_t *task,		// descritor da nova tarefa
+                    int cpu,			// cpu da nova tarefa
+                    void (*start_func)(void *),	// funcao corpo da tarefa
+                    void *arg) ;		// argumentos para a tarefa
+
+// Cria uma nova tarefa com os atributos indicados (tamanho da pilha,
+// prioridade e nome; NULL para os padrões). A pilha é reservada apenas na
+// primeira execução da tarefa, com uma página de guarda que interrompe o
+// programa em caso de estouro. Com copy_stack, a tarefa executa em uma pilha
+// compartilhada por todas as tarefas copy_stack e apenas a parte usada da
+// sua pilha ocupa memória enquanto ela não executa, ao custo de uma cópia a
+// cada troca entre duas delas (somente com uma cpu). Retorna um ID> 0 ou
+// erro.
+int task_create_ex (task_t *task,		// descritor da nova tarefa
+                    task_attr_t *attr,		// atributos da nova tarefa
+                    void (*start_func)(void *),	// funcao corpo da tarefa
+                    void *arg) ;		// argumentos para a tarefa
+
+// Cria uma nova tarefa com o descritor alocado pelo núcleo, de blocos de
+// descritores contíguos alinhados às linhas de cache. A tarefa deve ser
+// aguardada por uma única chamada a task_join ou destacada com task_detach;
+// o descritor é reciclado quando task_join retorna ou, se destacada, quando
+// ela termina. Retorna o descritor ou NULL em caso de erro.
+task_t *task_spawn (void (*start_func)(void *),	// funcao corpo da tarefa
+                    void *arg) ;		// argumentos para a tarefa
+
+// Cria n tarefas com uma única alocação para os seus descritores e pilhas;
+// a tarefa i recebe args[i] (NULL se args for NULL) e o seu descritor é
+// devolvido em tasks[i], como em task_spawn. Sem o vetor tasks, as tarefas
+// são criadas destacadas. As pilhas do bloco não têm páginas de guarda entre
+// si. Retorna o número de tarefas criadas ou erro.
+int task_spawn_n (task_t *tasks[],		// descritores das novas tarefas
+                  int n,			// número de tarefas
+                  void (*start_func)(void *),	// funcao corpo das tarefas
+                  void *args[]) ;		// argumentos de cada tarefa
+
+// Destaca uma tarefa criada por task_spawn: o seu descritor é reciclado
+// assim que ela termina e ela não pode mais ser aguardada. Retorna 0 ou erro.
+int task_detach (task_t *task) ;
+
 // Termina a tarefa corrente, indicando um valor de status encerramento
 void task_exit (int exitCode) ;
 
@@ -48,8 +123,8 @@ int task_id () ;
 // operações de escalonamento ==================================================
 
 // libera o processador para a próxima tarefa, retornando à fila de tarefas
-// prontas ("ready queue")
-void task_yield () ;
+// prontas ("ready queue"); retorna 0, ou -1 se chamada por uma micro-tarefa
+int task_yield () ;
 
 // define a prioridade estática de uma tarefa (ou a tarefa atual)
 void task_setprio (task_t *task, int prio) ;
@@ -57,19 +132,39 @@ void task_setprio (task_t *task, int prio) ;
 // retorna a prioridade estática de uma tarefa (ou a tarefa atual)
 int task_getprio (task_t *task) ;
 
+// operações de tempo real ====================================================
+
+// torna uma tarefa (ou a tarefa atual) de tempo real, com prazo relativo de
+// deadline ms a partir de agora e liberações a cada period ms (0 para uma
+// tarefa aperiódica); deadline 0 a torna novamente uma tarefa normal
+int task_setdeadline (task_t *task, int deadline, int period) ;
+
+// encerra a ativação corrente da tarefa periódica e aguarda a próxima
+// liberação. task_exit conclui apenas a ativação iniciada por
+// task_setdeadline, se task_waitperiod não foi chamada: a tarefa periódica
+// deve concluir a sua última ativação com task_waitperiod
+int task_waitperiod () ;
+
 // operações de sincronização ==================================================
 
-// a tarefa corrente aguarda o encerramento de outra task
+// a tarefa corrente aguarda o encerramento de outra task; o código de
+// encerramento de uma tarefa de task_spawn é retornado mesmo se ela já
+// tiver terminado
 int task_join (task_t *task) ;
 
 // operações de gestão do tempo ================================================
 
-// suspende a tarefa corrente por t milissegundos
-void task_sleep (int t) ;
+// suspende a tarefa corrente por t milissegundos; retorna 0, ou -1 se
+// chamada por uma micro-tarefa
+int task_sleep (int t) ;
 
 // retorna o relógio atual (em milisegundos)
 unsigned int systime () ;
 
+// retorna o tempo total em que as cpus ficaram ociosas, sem tarefas prontas
+// (em milisegundos)
+unsigned int idletime () ;
+
 // operações de IPC ============================================================
 
 // semáforos
@@ -128,6 +223,166 @@ int mqueue_destroy (mqueue_t *queue) ;
 // informa o número de mensagens atualmente na fila
 int mqueue_msgs (mqueue_t *queue) ;
 
+// filas de mensagens entre cpus (um produtor e um consumidor)
+
+// cria uma fila para até max mensagens de size bytes cada
+int xqueue_create (xqueue_t *queue, int max, int size) ;
+
+// envia uma mensagem para a fila, suspendendo a tarefa enquanto estiver cheia
+int xqueue_send (xqueue_t *queue, void *msg) ;
+
+// recebe uma mensagem da fila, suspendendo a tarefa enquanto estiver vazia
+int xqueue_recv (xqueue_t *queue, void *msg) ;
+
+// destroi a fila, liberando as tarefas que aguardam
+int xqueue_destroy (xqueue_t *queue) ;
+
+// informa o número de mensagens atualmente na fila
+int xqueue_msgs (xqueue_t *queue) ;
+
+// pools de tarefas
+
+// cria um pool com size tarefas que executam os trabalhos submetidos
+int task_pool_create (task_pool_t *pool, int size) ;
+
+// submete o trabalho func(arg) ao pool; os trabalhos de maior prioridade (de
+// -20 a +20, como as tarefas) são executados primeiro e o worker assume a
+// prioridade do trabalho enquanto o executa
+int task_pool_submit (task_pool_t *pool, void (*func)(void *), void *arg, int prio) ;
+
+// aguarda a conclusão de todos os trabalhos submetidos ao pool; não deve ser
+// chamada por um trabalho do próprio pool
+int task_pool_wait (task_pool_t *pool) ;
+
+// conclui os trabalhos pendentes, encerra as tarefas do pool e, com
+// PPOS_STATS=1, imprime as suas estatísticas (profundidade das filas e
+// espera dos trabalhos)
+int task_pool_destroy (task_pool_t *pool) ;
+
+// futuros
+
+// Cria uma tarefa que executa func(arg) e retorna um futuro para o seu
+// resultado, ou NULL em caso de erro. O futuro é alocado pelo núcleo e deve
+// ser destruído com future_destroy depois de obtido o valor.
+future_t *task_async (void *(*func)(void *), void *arg) ;
+
+// cria um futuro sem valor (promessa), definido depois com future_set
+int future_create (future_t *f) ;
+
+// define o valor do futuro, executando as suas continuações na tarefa
+// corrente e acordando as tarefas que o aguardam; o valor é definido uma
+// única vez
+int future_set (future_t *f, void *value) ;
+
+// define o valor do futuro como uma cópia de size bytes (até FUTURE_BLOB) de
+// data, guardada dentro do próprio futuro
+int future_set_blob (future_t *f, const void *data, int size) ;
+
+// aguarda o valor do futuro, suspendendo a tarefa corrente como em
+// task_join; retorna o valor (ou o endereço da cópia de future_set_blob)
+void *future_get (future_t *f) ;
+
+// informa se o valor do futuro já está disponível
+int future_ready (future_t *f) ;
+
+// Registra uma continuação: quando o valor de f for definido, func(valor,
+// arg) executa na tarefa que o definiu, sem criar outra tarefa, e o seu
+// resultado define o futuro retornado (alocado pelo núcleo). Se o valor já
+// estiver definido, func executa imediatamente.
+future_t *future_then (future_t *f, void *(*func)(void *value, void *arg), void *arg) ;
+
+// destroi o futuro, liberando as tarefas que o aguardam; um futuro alocado
+// pelo núcleo só pode ser destruído depois que o seu valor foi definido
+int future_destroy (future_t *f) ;
+
+// geradores
+
+// Cria um gerador que executa func(arg) em uma tarefa própria; o corpo
+// produz valores com task_yield_value, só executa quando a tarefa
+// consumidora pede o próximo valor com task_next e termina retornando (não
+// com task_exit). Um gerador não consumido até o fim nem destruído não
+// impede o encerramento do sistema, mas a sua tarefa e a sua pilha só são
+// liberadas por task_generator_destroy
+int task_generator_create (generator_t *gen, void (*func)(void *), void *arg) ;
+
+// Chamada pelo corpo de um gerador: entrega o ponteiro value (não nulo, não
+// copiado) à tarefa em task_next e lhe devolve o processador diretamente,
+// sem passar pelo escalonador. Retorna 0 quando o próximo valor é pedido, ou
+// -1 se o gerador foi destruído, caso em que o corpo deve terminar.
+int task_yield_value (void *value) ;
+
+// Entrega o processador diretamente ao gerador e retorna o próximo valor que
+// ele produzir, ou NULL quando o seu corpo termina; apenas uma tarefa por
+// vez pode consumir os valores de um gerador
+void *task_next (generator_t *gen) ;
+
+// destroi o gerador: se o corpo ainda não terminou, o seu task_yield_value
+// retorna -1; aguarda o término da tarefa do gerador
+int task_generator_destroy (generator_t *gen) ;
+
+// pipelines
+
+// cria um pipeline vazio
+int pipeline_create (pipeline_t *pipe) ;
+
+// Declara um estágio executado por parallelism workers; func (veja
+// stage_func_t) produz itens de item_size bytes (0 se o estágio não tem
+// saída) e capacity é a capacidade da sua fila de entrada, em itens.
+// Retorna o número do estágio, usado em pipeline_connect.
+int pipeline_stage (pipeline_t *pipe, const char *name, stage_func_t func, void *arg,
+                    int item_size, int parallelism, int capacity) ;
+
+// liga a saída do estágio from à entrada do estágio to; cada estágio tem uma
+// única saída, mas pode receber de vários estágios
+int pipeline_connect (pipeline_t *pipe, int from, int to) ;
+
+// cria as filas e os workers e inicia o pipeline; os estágios sem entrada
+// produzem itens até o seu corpo retornar 0
+int pipeline_run (pipeline_t *pipe) ;
+
+// aguarda o término de todos os estágios, destroi o pipeline e, com
+// PPOS_STATS=1, imprime as estatísticas de cada estágio (vazão, ocupação da
+// fila de entrada, processamento e esperas) e o gargalo
+int pipeline_wait (pipeline_t *pipe) ;
+
+// laços paralelos
+
+// Executa fn(b, e, ctx) para partes [b, e) que cobrem o intervalo [begin,
+// end), divididas recursivamente entre a tarefa corrente e os workers
+// mantidos pelo núcleo (um por cpu além da corrente), e retorna quando todas
+// terminam. Cada parte tem grain iterações; com grain <= 0 o tamanho é
+// ajustado a cada chamada, pelo tempo de processamento observado nas
+// chamadas anteriores com a mesma fn, para que cada parte dure cerca de
+// PARALLEL_GRAIN ms. fn não deve bloquear a tarefa nem chamar outro laço
+// paralelo.
+int task_parallel_for (long begin, long end, long grain,
+                       void (*fn)(long begin, long end, void *ctx), void *ctx) ;
+
+// Como task_parallel_for, mas cada parte retorna um valor parcial, combinado
+// com combine ao valor inicial *result, na ordem em que as partes terminam;
+// combine deve ser associativa e comutativa
+int task_parallel_reduce (long begin, long end, long grain,
+                          long (*fn)(long begin, long end, void *ctx),
+                          long (*combine)(long a, long b), void *ctx, long *result) ;
+
+// corrotinas
+
+// As corrotinas sem pilha, escalonadas junto com as tarefas, são escritas em
+// C++20 com ppos::task<T>, declarada em ppos_coro.hpp
+
+// micro-tarefas
+
+// Agenda a chamada fn(arg), executada pelo dispatcher da cpu corrente na sua
+// própria pilha, sem criar uma tarefa; até PPOS_DEFER_BUDGET (padrão
+// DEFER_BUDGET) micro-tarefas executam entre duas escolhas do escalonador.
+// fn deve ser curta e não pode bloquear: as operações bloqueantes (sem_down,
+// mqueue_send, mqueue_recv, xqueue_send, xqueue_recv, task_join, task_sleep,
+// task_yield, future_get, task_next, task_generator_destroy, task_pool_wait,
+// task_pool_destroy, pipeline_wait, task_parallel_for, task_parallel_reduce)
+// chamadas por uma micro-tarefa retornam -1 (NULL) sem efeito, e task_exit
+// retorna sem encerrar o dispatcher. Retorna 0, ou -1 em caso de erro.
+int ppos_defer (void (*fn)(void *), void *arg) ;
+
 //==============================================================================
 
 // Redefinir funcoes POSIX "proibidas" como "FORBIDDEN" (gera erro ao compilar)
@@ -1,21 +1,109 @@
+#include <limits.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "ppos.h"
 
+#define STACK_LOW_MARGIN 512 // abaixo de task_switch, ainda parte da pilha usada
+#define RECLAIM_INTERVAL 100 // intervalo mínimo (ms) entre devoluções de pilhas
+
+// limites das linhas de cache do descritor descritos em ppos_data.h
+_Static_assert(offsetof(task_t, stack_ptr) == 64, "escalonamento fora da primeira linha");
+_Static_assert(offsetof(task_t, id) == 128, "troca de contexto fora da segunda linha");
+
 task_t dispatcher_task; // descritor da tarefa dispatcher
-task_t *current_task;   // ponteiro para a tarefa corrente
-task_t *ready_queue;    // ponteiro para a fila de tarefas prontas
 
-static task_t main_task;        // descritor da tarefa main
-static task_t *sleep_queue;     // ponteiro para a fila de tarefas adormecidas
-static int user_tasks = 0;      // contador de tarefas do usuário
-static int next_id = 0;         // id da próxima tarefa
-static unsigned int clock;      // relógio do sistema
-static struct sigaction action; // tratador de sinal
-static struct itimerval timer;  // inicialização do timer
+// estado de cada cpu (thread do sistema) que executa tarefas
+__thread task_t *current_task;                      // tarefa corrente
+__thread task_t *cpu_dispatcher = &dispatcher_task; // dispatcher da cpu
+__thread int kernel_lock = 0;                       // impede a preempção dentro do núcleo
+static __thread int idle = 0;                       // cpu ociosa, aguardando um sinal
+static __thread int preempted = 0;                  // troca feita pelo tratador de sinal
+static __thread task_t *prev_task;                  // tarefa que acabou de deixar a cpu
+static __thread task_t *dead_task;                  // tarefa encerrada deixando a cpu
+static __thread task_t *dispatch_next;              // tarefa escolhida antes do dispatcher
+
+// cada cpu cuida das tarefas que adormeceram nela
+static __thread task_t *sleep_queue;                 // fila de tarefas adormecidas
+static __thread int sleep_lock = 0;                  // protege a fila de tarefas adormecidas
+static __thread unsigned int rt_wakeup = UINT_MAX;   // próxima liberação de tempo real
+static __thread unsigned int next_wakeup = UINT_MAX; // próxima tarefa a acordar
+
+static task_t main_task;         // descritor da tarefa main
+static int join_lock = 0;        // protege as filas de tarefas suspensas
+static int user_tasks = 0;       // contador de tarefas do usuário
+static int next_id = 0;          // id da próxima tarefa
+static unsigned int sys_clock;   // relógio do sistema
+static struct sigaction action;  // tratador de sinal
+static struct itimerval timer;   // inicialização do timer
+static unsigned int idle_time = 0;        // tempo ocioso total das cpus
+static unsigned int interrupts = 0;       // disparos do temporizador
+static int ready_tasks = 0;               // tarefas nas filas de prontas
+static task_t *all_tasks = NULL;          // lista de todas as tarefas
+static int tasks_lock = 0;                // protege a lista de todas as tarefas
+static int reclaim_delay = RECLAIM_DELAY; // bloqueio após o qual a pilha é devolvida
+int print_stats = 0;                      // relatórios de uso no encerramento
+
+// modo sem ticks: o relógio é lido de um relógio monotônico e o temporizador
+// é programado apenas para o próximo evento (fim do quantum ou despertar)
+static int tickless = 0;                    // modo sem ticks ativo
+static struct timespec boot;                // instante da inicialização
+static unsigned int timer_event = UINT_MAX; // próximo disparo programado
+static unsigned int quantum_end;            // fim do quantum da tarefa corrente
+
+static const sched_class_t *sched; // política de escalonamento corrente
+
+extern const sched_class_t *sched_class(sched_policy_t policy);
+extern int sched_policy_byname(const char *name);
+extern const sched_class_t edf_class;
+extern int edf_preempts(task_t *task);
+
+extern int smp_cpus;
+extern int smp_sharded;
+extern __thread int cpu_id;
+extern const sched_class_t smp_class;
+extern void smp_start(void);
+extern void smp_kick(void);
+extern void smp_idle(int idle);
+
+extern int stack_pool_max;
+extern int stack_check;
+extern void stack_paint(void *stack, size_t size);
+extern size_t stack_usage(void *stack, size_t size);
+extern size_t stack_reclaim(void *stack, void *low);
+extern size_t stack_size(size_t size);
+extern void *stack_alloc(size_t size);
+extern void stack_free(void *stack, size_t size);
+extern void stack_print(void);
+extern void stack_copy_out(void **buf, size_t *capacity, void *from, size_t size);
+extern void stack_copy_in(void *to, void *buf, size_t size);
+extern void stack_copy_free(void *buf, size_t capacity);
+
+extern task_t *slab_alloc(void);
+extern task_t *slab_alloc_n(int n);
+extern void *slab_stack(task_t *task);
+extern void slab_free(task_t *task);
+
+extern void parallel_print(void);
+
+extern __thread int deferred;
+extern __thread int deferring;
+extern int defer_budget;
+extern void defer_run(void);
+extern void defer_print(void);
+
+void reschedule(void);
+static void task_entry(void);
+static void task_report(task_t *task);
+
+#ifdef FAST_SWITCH
+extern void ctx_switch(void **save_sp, void *new_sp);
+extern void ctx_make(task_t *task, void (*start_func)(void *), void *arg);
+#endif
 
 // print_elem é passada para a função queue_print, utilizada em mensagens de
 // depuração, para acompanhar o uso da fila de tarefas prontas.
@@ -23,61 +111,191 @@ __attribute__((unused)) static void print_elem(void *ptr) {
     printf("%d", ((task_t *)ptr)->id);
 }
 
-static void tick_handler(void) {
-    clock++; // incrementa o relógio do sistema
+// classe de escalonamento da tarefa: as tarefas com prazo são de tempo real,
+// as demais seguem a política corrente
+static inline const sched_class_t *task_class(task_t *task) {
+    return task->rt_deadline > 0 ? &edf_class : sched;
+}
 
-    // calcula o tempo parcial de processamento da tarefa corrente
-    current_task->proc_time += clock - current_task->proc_marker;
-    current_task->proc_marker = clock;
+// entra em uma seção crítica do núcleo; a preempção fica adiada até a saída,
+// para que nenhuma tarefa perca o processador segurando a trava
+void enter_cs(int *lock) {
+    kernel_lock++;
 
-    if (!current_task->is_sys_task) {
-        current_task->quantum--;
+    while (__sync_fetch_and_or(lock, 1))
+        ;
+}
 
-        if (current_task->quantum == 0) {
-            task_switch(&dispatcher_task);
-        }
+void leave_cs(int *lock) {
+    __sync_lock_release(lock);
+    kernel_lock--;
+}
+
+// atualiza o relógio a partir do relógio monotônico, no modo sem ticks; o
+// relógio nunca retrocede, mesmo se o tratador de sinal o atualizar no meio
+static void clock_update(void) {
+    struct timespec ts;
+
+    if (!tickless) {
+        return;
     }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    unsigned int now = (ts.tv_sec - boot.tv_sec) * 1000 + (ts.tv_nsec - boot.tv_nsec) / 1000000;
+    unsigned int old;
+
+    while ((int)(now - (old = sys_clock)) > 0 && !__sync_bool_compare_and_swap(&sys_clock, old, now))
+        ;
 }
 
-static task_t *scheduler(void) {
-    if (ready_queue == NULL) {
-        return NULL;
+// programa um único disparo do temporizador para o instante at (UINT_MAX
+// desarma o temporizador); um instante já passado dispara em 1 ms
+static void timer_set(unsigned int at) {
+    struct itimerval shot = {0};
+
+    timer_event = at;
+
+    if (at != UINT_MAX) {
+        unsigned int delay = (int)(at - sys_clock) > 0 ? at - sys_clock : 1;
+
+        shot.it_value.tv_sec = delay / 1000;
+        shot.it_value.tv_usec = (delay % 1000) * 1000;
+    }
+
+    if (setitimer(ITIMER_REAL, &shot, NULL) < 0) {
+        perror("Erro ao programar o temporizador");
+        exit(1);
+    }
+}
+
+// reprograma o temporizador para o instante at, a menos que um disparo
+// anterior a ele já esteja pendente (o tratador desmarca timer_event ao
+// disparar): ao disparar, o tratador reavalia o próximo evento, o que evita
+// uma chamada de sistema a cada troca de tarefa
+static void timer_update(unsigned int at) {
+    if (timer_event <= at) {
+        return;
+    }
+
+    timer_set(at);
+}
+
+// próximo evento da tarefa corrente: o fim do seu quantum, se houver outras
+// tarefas prontas ou por acordar, ou o próximo despertar
+static unsigned int next_event(unsigned int end) {
+    if (ready_tasks > 0 || next_wakeup <= sys_clock) {
+        return end < next_wakeup ? end : next_wakeup;
     }
 
-    task_t *next_task = ready_queue;
-    task_t *aux = ready_queue->next;
+    return next_wakeup;
+}
+
+// contabiliza o processamento da tarefa desde a última contabilização
+static void account(task_t *task) {
+    task_class(task)->on_tick(task, sys_clock - task->proc_marker);
+    task->proc_time += sys_clock - task->proc_marker;
+    task->proc_marker = sys_clock;
+}
 
-    // percorre a fila de prontas em busca da tarefa com maior prioridade
-    while (aux != ready_queue) {
+// tempo de processamento da tarefa corrente, incluindo a parte ainda não
+// contabilizada, que no modo sem ticks pode ser longa
+unsigned int task_proctime(void) {
+    clock_update();
+    return current_task->proc_time + (sys_clock - current_task->proc_marker);
+}
 
-        // a próxima tarefa será aquela com a maior prioridade dinâmica;
-        // em caso de empate, a próxima tarefa será aquela com maior
-        // prioridade estática
-        if ((aux->dynamic_prio < next_task->dynamic_prio) ||
-            (aux->dynamic_prio == next_task->dynamic_prio &&
-             aux->static_prio < next_task->static_prio)) {
+// a tarefa deixa de impedir o encerramento do sistema e, se terminar, não é
+// descontada de novo; usada para os workers mantidos pelo núcleo
+void task_background(task_t *task) {
+    if (task->status != FINISHED && __sync_bool_compare_and_swap(&task->background, 0, 1)) {
+        __sync_fetch_and_sub(&user_tasks, 1);
+    }
+}
 
-            next_task = aux;
+// insere uma tarefa na fila de prontas, conforme a política de escalonamento;
+// o status muda antes da inserção porque, com várias cpus, a tarefa pode ser
+// escolhida por outra cpu assim que entra na fila
+void ready_append(task_t *task) {
+    kernel_lock++;
+    task->status = READY;
+    task_class(task)->enqueue(task);
+    __sync_fetch_and_add(&ready_tasks, 1);
+
+    // no modo sem ticks, a tarefa corrente deixa de estar sozinha e o fim do
+    // seu quantum precisa ser programado
+    if (tickless && current_task != NULL && current_task != task &&
+        !current_task->is_sys_task && quantum_end < timer_event) {
+        timer_set(quantum_end);
+    }
+    kernel_lock--;
+}
+
+static void tick_handler(int signum) {
+    // o relógio avança apenas com o SIGALRM, recebido por uma das cpus, que
+    // repassa o tick às demais
+    if (signum == SIGALRM) {
+        interrupts++;
+
+        if (tickless) {
+            clock_update(); // o disparo programado ocorreu
+            timer_event = UINT_MAX;
+        } else {
+            sys_clock++; // incrementa o relógio do sistema
         }
 
-        aux = aux->next;
+        if (smp_cpus > 1) {
+            smp_kick();
+        }
+    }
+
+    // o tempo em que a cpu esteve ociosa não é contabilizado ao dispatcher
+    if (idle) {
+        __sync_fetch_and_add(&idle_time, sys_clock - current_task->proc_marker);
+        current_task->proc_marker = sys_clock;
+        return;
     }
 
-    // envelhecimento das tarefas não escolhidas
-    aux = next_task->next;
+    // no modo sem ticks o quantum é consumido pelo tempo decorrido
+    int ticks = tickless ? sys_clock - current_task->proc_marker : 1;
 
-    while (aux != next_task) {
-        if (aux->dynamic_prio > MAX_PRIORITY) {
-            aux->dynamic_prio += AGING_FACTOR;
+    // calcula o tempo parcial de processamento da tarefa corrente
+    account(current_task);
+
+    if (!current_task->is_sys_task) {
+        current_task->quantum -= ticks;
+
+        // uma tarefa de tempo real liberada ou mais urgente toma o processador
+        if (rt_wakeup <= sys_clock || edf_preempts(current_task)) {
+            current_task->quantum = 0;
         }
 
-        aux = aux->next;
+        // a preempção é adiada enquanto a tarefa estiver dentro do núcleo
+        if (current_task->quantum <= 0 && kernel_lock == 0) {
+            preempted = 1;
+            reschedule();
+            preempted = 0;
+        } else if (tickless) {
+            // o quantum restante, ou a preempção adiada, precisa de um novo
+            // disparo
+            timer_update(next_event(sys_clock + (current_task->quantum > 0 ? current_task->quantum : 1)));
+        }
+    }
+}
+
+static task_t *scheduler(void) {
+    task_t *task = edf_class.pick_next();
+
+    // as tarefas de tempo real têm preferência sobre as demais
+    if (task == NULL) {
+        task = sched->pick_next();
     }
 
-    // reseta a prioridade dinâmica da nova tarefa a ser executada
-    next_task->dynamic_prio = next_task->static_prio;
+    if (task != NULL) {
+        __sync_fetch_and_sub(&ready_tasks, 1);
+    }
 
-    return next_task;
+    return task;
 }
 
 static void wake_tasks(void) {
@@ -85,10 +303,15 @@ static void wake_tasks(void) {
     queue_print("### [sleep_queue] ", (queue_t *)sleep_queue, print_elem);
 #endif
 
+    rt_wakeup = UINT_MAX;
+    next_wakeup = UINT_MAX;
+
     if (sleep_queue == NULL) {
         return;
     }
 
+    enter_cs(&sleep_lock);
+
     task_t *task = sleep_queue;
 
     // percorre a fila de tarefas adormecidas
@@ -96,147 +319,776 @@ static void wake_tasks(void) {
         task_t *next = task->next;
 
         // devolve à fila de prontas as tarefas que já podem acordar
-        if (clock >= task->wakeup_time) {
+        if (sys_clock >= task->wakeup_time) {
             queue_remove((queue_t **)&sleep_queue, (queue_t *)task);
-            task->status = READY;
-            queue_append((queue_t **)&ready_queue, (queue_t *)task);
+            ready_append(task);
+        } else {
+            if (task->rt_deadline > 0 && task->wakeup_time < rt_wakeup) {
+                rt_wakeup = task->wakeup_time; // próxima liberação de tempo real
+            }
+
+            if (task->wakeup_time < next_wakeup) {
+                next_wakeup = task->wakeup_time;
+            }
         }
 
         task = next;
     } while (task != sleep_queue && sleep_queue != NULL);
+
+    leave_cs(&sleep_lock);
 }
 
-static void dispatcher(void) {
-#if DEBUG
-    printf("%-18s: tarefa dispatcher lançada\n", "### (dispatcher)");
+// nenhuma tarefa pronta: em vez de girar no laço do dispatcher, a cpu dorme
+// até o próximo sinal (tick do relógio ou repasse de outra cpu), quando as
+// tarefas adormecidas podem acordar. Os sinais ficam bloqueados entre a
+// verificação e a espera, para que nenhum tick se perca entre elas.
+static void cpu_idle(void) {
+    sigset_t ticks, mask;
+
+    sigemptyset(&ticks);
+    sigaddset(&ticks, SIGALRM);
+    sigaddset(&ticks, SMP_TICK_SIGNAL);
+    sigprocmask(SIG_BLOCK, &ticks, &mask);
+
+    idle = 1;
+    if (smp_cpus > 1) {
+        smp_idle(1);
+    }
+
+    sigsuspend(&mask);
+
+    if (smp_cpus > 1) {
+        smp_idle(0);
+    }
+    idle = 0;
+
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+// insere a tarefa na lista de todas as tarefas, usada pela devolução de
+// pilhas; a lista tem encadeamento próprio, pois a tarefa também está nas
+// filas de prontas ou de espera
+static void list_insert(task_t *task) {
+    enter_cs(&tasks_lock);
+    if (all_tasks == NULL) {
+        task->list_prev = task->list_next = task;
+    } else {
+        task->list_next = all_tasks;
+        task->list_prev = all_tasks->list_prev;
+        all_tasks->list_prev->list_next = task;
+        all_tasks->list_prev = task;
+    }
+    all_tasks = task;
+    leave_cs(&tasks_lock);
+}
+
+static void list_remove(task_t *task) {
+    enter_cs(&tasks_lock);
+    if (task->list_next == task) {
+        all_tasks = NULL;
+    } else {
+        task->list_prev->list_next = task->list_next;
+        task->list_next->list_prev = task->list_prev;
+
+        if (all_tasks == task) {
+            all_tasks = task->list_next;
+        }
+    }
+    leave_cs(&tasks_lock);
+}
+
+// devolve ao sistema a parte livre das pilhas das tarefas bloqueadas há pelo
+// menos reclaim_delay ms. Executada pelo dispatcher quando a cpu fica
+// ociosa, e só com uma cpu: nenhuma dessas tarefas pode voltar a executar
+// enquanto as suas páginas são devolvidas.
+static void reclaim_stacks(void) {
+    static unsigned int last = 0;
+
+    if (sys_clock - last < RECLAIM_INTERVAL || all_tasks == NULL) {
+        return;
+    }
+
+    last = sys_clock;
+
+    enter_cs(&tasks_lock);
+    task_t *task = all_tasks;
+
+    do {
+        if ((task->status == SUSPENDED || task->status == SLEEPING) && !task->reclaimed &&
+            !task->copy_stack && task->context.uc_stack.ss_sp != NULL &&
+            sys_clock - task->blocked_since >= (unsigned int)reclaim_delay) {
+            stack_reclaim(task->context.uc_stack.ss_sp, task->stack_low);
+            task->reclaimed = 1;
+        }
+
+        task = task->list_next;
+    } while (task != all_tasks);
+    leave_cs(&tasks_lock);
+}
+
+// pilha compartilhada =========================================================
+
+// As tarefas copy_stack executam todas em shared_stack. O conteúdo de apenas
+// uma delas, shared_owner, está na pilha a cada momento; as demais guardam a
+// parte usada das suas pilhas em buffers próprios. A troca do conteúdo só
+// ocorre quando outra tarefa copy_stack vai executar: trocas com as demais
+// tarefas não fazem cópias.
+
+static char *shared_stack = NULL;  // pilha de execução compartilhada
+static task_t *shared_owner;       // tarefa cujo conteúdo está na pilha
+static task_t copier_task;         // troca o conteúdo da pilha compartilhada
+static task_t *copier_next;        // tarefa a instalar na pilha compartilhada
+
+// salva a parte usada da pilha compartilhada pela tarefa que a ocupa, exceto
+// se ela estiver se encerrando
+static void shared_save(void) {
+    task_t *task = shared_owner;
+
+    if (task == NULL || task == dead_task) {
+        return;
+    }
+
+    char *top = shared_stack + SHARED_STACKSIZE;
+
+    task->copy_size = top - (char *)task->stack_low;
+    stack_copy_out(&task->stack_copy, &task->copy_capacity, task->stack_low, task->copy_size);
+}
+
+// instala uma tarefa na pilha compartilhada: restaura a parte salva ou, na
+// primeira ativação, monta o seu contexto inicial
+static void shared_restore(task_t *task) {
+    char *top = shared_stack + SHARED_STACKSIZE;
+
+    if (task->copy_size > 0) {
+        stack_copy_in(top - task->copy_size, task->stack_copy, task->copy_size);
+    } else {
+#ifdef FAST_SWITCH
+        ctx_make(task, (void (*)(void *))task_entry, NULL);
+#else
+        makecontext(&(task->context), task_entry, 0);
+#endif
+    }
+
+    shared_owner = task;
+}
+
+// corpo do copiador, que executa na sua própria pilha: a tarefa que deixa a
+// pilha compartilhada não pode sobrescrevê-la enquanto executa nela
+static void copier(void) {
+    for (;;) {
+        shared_save();
+        shared_restore(copier_next);
+
+#ifdef FAST_SWITCH
+        ctx_switch(&copier_task.stack_ptr, copier_next->stack_ptr);
+#else
+        swapcontext(&copier_task.context, &copier_next->context);
 #endif
+    }
+}
+
+// cria a pilha compartilhada e o copiador, na criação da primeira tarefa
+// copy_stack
+static int shared_init(void) {
+    if (shared_stack != NULL) {
+        return 0;
+    }
 
-    // continua a execução enquanto houver tarefas não finalizadas
-    while (user_tasks > 0) {
-        wake_tasks(); // acorda as tarefas adormecidas
+    char *stack = stack_alloc(STACK_MIN_SIZE);
+
+    if (stack == NULL || (shared_stack = stack_alloc(SHARED_STACKSIZE)) == NULL) {
+        perror("Erro ao criar a pilha compartilhada");
+        return -1;
+    }
+
+#ifndef FAST_SWITCH
+    getcontext(&copier_task.context);
+#endif
+    copier_task.context.uc_stack.ss_sp = stack;
+    copier_task.context.uc_stack.ss_size = stack_size(STACK_MIN_SIZE);
+    copier_task.context.uc_stack.ss_flags = 0;
+    copier_task.context.uc_link = NULL;
+
+#ifdef FAST_SWITCH
+    ctx_make(&copier_task, (void (*)(void *))copier, NULL);
+#else
+    makecontext(&copier_task.context, copier, 0);
+#endif
+
+    return 0;
+}
+
+// marca a tarefa como encerrada e acorda as tarefas suspensas à sua espera;
+// retorna se o descritor da tarefa está destacado
+static int task_finish(task_t *task) {
+    enter_cs(&join_lock);
+    task->status = FINISHED;
+    while (task->suspend_queue != NULL) {
+        task_t *t = task->suspend_queue;
+
+        queue_remove((queue_t **)&(task->suspend_queue), (queue_t *)t);
+        ready_append(t);
+    }
+    int detached = task->detached;
+    leave_cs(&join_lock);
+
+    return detached;
+}
+
+// conclui o encerramento de uma tarefa que já deixou a cpu: libera a sua
+// pilha e acorda as tarefas suspensas. Só então a tarefa passa a constar
+// como encerrada, pois a partir daí o seu descritor pode ser reutilizado.
+static void task_done(task_t *task) {
+    list_remove(task);
+
+    if (task->copy_stack) {
+        stack_copy_free(task->stack_copy, task->copy_capacity);
+
+        if (shared_owner == task) {
+            shared_owner = NULL;
+        }
+    } else if (slab_stack(task) == NULL) {
+        stack_free(task->context.uc_stack.ss_sp, task->context.uc_stack.ss_size);
+    }
+
+    // um descritor do núcleo destacado volta ao núcleo assim que a tarefa
+    // deixa a cpu; os demais, quando task_join retorna
+    if (task_finish(task)) {
+        slab_free(task);
+    }
+}
+
+// conclui uma troca de contexto, já no contexto da tarefa que entrou:
+// permite que outra cpu retome a tarefa que saiu, pois o seu contexto já
+// está salvo, ou conclui o seu encerramento
+static void finish_switch(void) {
+    kernel_lock = current_task->lock_depth;
+
+    if (prev_task != NULL) {
+        __atomic_store_n(&prev_task->on_cpu, 0, __ATOMIC_RELEASE);
+    }
+
+    if (dead_task != NULL) {
+        task_done(dead_task);
+        dead_task = NULL;
+    }
+
+#ifdef FAST_SWITCH
+    // a troca rápida não restaura a máscara de sinais: ao sair de uma
+    // preempção os ticks ainda estão bloqueados pelo tratador, que só os
+    // desbloqueia quando a tarefa preemptada retomar
+    if (preempted) {
+        sigset_t ticks;
+
+        preempted = 0;
+        sigemptyset(&ticks);
+        sigaddset(&ticks, SIGALRM);
+        sigaddset(&ticks, SMP_TICK_SIGNAL);
+        sigprocmask(SIG_UNBLOCK, &ticks, NULL);
+    }
+#endif
+}
+
+// ponto de entrada de todas as tarefas: conclui a troca que as iniciou antes
+// de executar o seu corpo
+static void task_entry(void) {
+    finish_switch();
+
+    current_task->start_func(current_task->arg);
+
+    task_exit(0);
+}
+
+// entrega o processador à tarefa escolhida pelo escalonador
+static void run_task(task_t *task) {
+    // uma tarefa acordada por outra cpu pode ainda estar salvando o seu
+    // contexto na cpu em que executava
+    if (task != current_task) {
+        while (__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE))
+            ;
+    }
+
+    task->quantum = TICKS; // tarefa recebe um quantum de ticks
+    task->status = RUNNING;
+    task->on_cpu = 1;
+
+    // sozinha, a tarefa executa sem interrupções até o próximo despertar;
+    // senão, até o fim do quantum
+    if (tickless) {
+        quantum_end = sys_clock + TICKS;
+        timer_update(next_event(quantum_end));
+    }
+
+    // a tarefa que escolheu a si mesma continua executando, sem troca
+    if (task == current_task) {
+        task->activations++;
+        return;
+    }
+
+    task_switch(task); // transfere o controle para a nova tarefa
+}
+
+// corrotinas ==================================================================
+
+// As corrotinas (ppos_coro.hpp) não têm pilha nem contexto próprios: a função
+// resume do descritor as retoma até a próxima suspensão e retorna 1 quando
+// terminam. Elas ficam nas mesmas filas que as demais tarefas, mas executam
+// apenas no dispatcher, como chamadas de função na sua pilha: uma tarefa que
+// escolhe uma corrotina entrega o processador ao dispatcher, e as corrotinas
+// seguintes executam sem troca de contexto. As micro-tarefas (ppos_defer.c)
+// também executam no dispatcher. Executá-las na pilha da tarefa
+// que sai a manteria na cpu, e outra cpu que a escolhesse ficaria à espera.
+// Sem contexto onde ficar interrompida, a corrotina não é preemptada. Ao se
+// suspender no núcleo, ela já está na fila de espera quando resume retorna.
+
+// encerra uma corrotina; destacada, o seu quadro e o seu descritor são
+// liberados aqui
+static void coro_done(task_t *coro) {
+    coro->exit_code = 0;
+    coro->exec_end = sys_clock;
+    task_report(coro);
+
+    list_remove(coro);
+    __sync_fetch_and_sub(&user_tasks, 1);
+
+    // chamada depois do término, resume destroi o quadro
+    if (task_finish(coro)) {
+        coro->resume(coro);
+        slab_free(coro);
+    }
+}
+
+// executa a corrotina até a sua próxima suspensão, na pilha do dispatcher
+static void coro_run(task_t *coro) {
+    task_t *t = current_task;
+
+    // a corrotina acordada por outra cpu pode ainda estar executando nela
+    while (__atomic_load_n(&coro->on_cpu, __ATOMIC_ACQUIRE))
+        ;
+
+    coro->quantum = TICKS;
+    coro->status = RUNNING;
+    coro->on_cpu = 1;
+    coro->activations++;
+
+    if (tickless) {
+        clock_update();
+        account(t);
+    }
+
+    current_task = coro;
+    coro->proc_marker = sys_clock;
+
+    int done = coro->resume(coro);
+
+    if (tickless) {
+        clock_update();
+        account(coro);
+    }
+
+    // o tempo da corrotina não é contabilizado ao dispatcher
+    current_task = t;
+    t->proc_marker = sys_clock;
+
+    if (done) {
+        coro_done(coro);
+        return;
+    }
+
+    // a corrotina que apenas cedeu o processador volta à fila de prontas
+    if (coro->status == RUNNING) {
+        ready_append(coro);
+    }
+
+    __atomic_store_n(&coro->on_cpu, 0, __ATOMIC_RELEASE);
+}
+
+// escolhe a próxima tarefa e lhe entrega o processador diretamente, ainda no
+// contexto da tarefa que o libera, sem passar pelo dispatcher; ele só recebe
+// o processador quando não há tarefas prontas, para executar uma corrotina ou
+// quando há micro-tarefas pendentes. A preempção fica desabilitada até a
+// tarefa voltar a executar.
+void reschedule(void) {
+    task_t *task = current_task;
+
+    // corrotinas executam na pilha do dispatcher e não podem bloqueá-lo; as
+    // operações bloqueantes já recusam as micro-tarefas, que executam no
+    // próprio dispatcher
+    if (task->resume != NULL) {
+        fprintf(stderr, "### Erro: a corrotina %d chamou uma operação bloqueante\n", task->id);
+        exit(1);
+    }
+
+    if (task == cpu_dispatcher) {
+        fprintf(stderr, "### Erro: o dispatcher chamou uma operação bloqueante\n");
+        exit(1);
+    }
+
+    kernel_lock++;
+    clock_update();
+    wake_tasks(); // acorda as tarefas adormecidas nesta cpu
+
+    // a tarefa que apenas cede o processador volta à fila de prontas; as
+    // demais estão bloqueadas, encerrando ou já foram acordadas
+    if (task->status == RUNNING && task != dead_task) {
+        ready_append(task);
+    } else if (task->status == SUSPENDED || task->status == SLEEPING) {
+        task->blocked_since = sys_clock;
+        task->reclaimed = 0;
+    }
 
 #ifdef DEBUG
-        queue_print("### [ready_queue] ", (queue_t *)ready_queue, print_elem);
+    edf_class.print();
+    sched->print();
 #endif
 
-        // escolhe a próxima tarefa a ser executada
-        task_t *task = scheduler();
+    task_t *next = scheduler();
+
+    // o dispatcher executa a corrotina escolhida, ou as micro-tarefas
+    // pendentes antes da tarefa escolhida
+    if (next != NULL && next->resume == NULL && deferred == 0) {
+        run_task(next);
+    } else {
+        dispatch_next = next;
+        task_switch(cpu_dispatcher);
+    }
+    kernel_lock--;
+}
+
+// Entrega o processador diretamente a uma tarefa suspensa, sem passar pelo
+// escalonador: a tarefa corrente é suspensa e cede à outra o restante do seu
+// quantum, como em uma chamada de função. Quem chama deve garantir que
+// alguém entregará o processador de volta (geradores).
+int task_handoff(task_t *task) {
+    task_t *t = current_task;
+
+    // o dispatcher não pode ser suspenso
+    if (t == cpu_dispatcher) {
+        return -1;
+    }
+
+    kernel_lock++;
+    t->status = SUSPENDED;
+    t->blocked_since = sys_clock;
+    t->reclaimed = 0;
+
+    // a tarefa pode ainda estar salvando o seu contexto em outra cpu
+    while (__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE))
+        ;
+
+    task->quantum = t->quantum;
+    task->status = RUNNING;
+    task->on_cpu = 1;
+
+    task_switch(task);
+    kernel_lock--;
+
+    return 0;
+}
+
+// corpo do dispatcher; com várias cpus, cada uma executa o seu próprio
+// dispatcher e a cpu 0 inicia as demais. As tarefas trocam o processador
+// diretamente entre si: o dispatcher só mantém a cpu ociosa enquanto não há
+// tarefas prontas e encerra o sistema
+void dispatcher(void) {
+#if DEBUG
+    printf("%-18s: tarefa dispatcher lançada\n", "### (dispatcher)");
+#endif
+
+    if (smp_cpus > 1 && cpu_id == 0) {
+        smp_start();
+    }
+
+    // continua a execução enquanto houver tarefas não finalizadas ou
+    // micro-tarefas pendentes nesta cpu
+    while (user_tasks > 0 || deferred > 0) {
+        clock_update();
+        wake_tasks(); // acorda as tarefas adormecidas nesta cpu
+
+        // no máximo defer_budget micro-tarefas entre duas escolhas, para que
+        // as tarefas prontas não esperem
+        if (deferred > 0) {
+            defer_run();
+        }
+
+        // escolhe a próxima tarefa a ser executada; a tarefa escolhida por
+        // quem entregou o processador ao dispatcher é executada antes de uma
+        // nova escolha
+        kernel_lock++;
+        task_t *task = dispatch_next != NULL ? dispatch_next : scheduler();
+
+        dispatch_next = NULL;
+
+        // a corrotina executa na pilha do dispatcher, que depois volta a
+        // escolher
+        if (task != NULL && task->resume != NULL) {
+            coro_run(task);
+            kernel_lock--;
+            continue;
+        }
 
         if (task != NULL) {
-            task->quantum = TICKS; // tarefa recebe um quantum de ticks
-
-            queue_remove((queue_t **)&ready_queue, (queue_t *)task);
-            task->status = RUNNING;
-            task_switch(task); // transfere o controle para a nova tarefa
-
-            switch (task->status) {
-            case RUNNING:
-                task->status = READY;
-                queue_append((queue_t **)&ready_queue, (queue_t *)task);
-                break;
-            case FINISHED:
-                // acorda as tarefas suspensas
-                while (task->suspend_queue != NULL) {
-                    task_t *t = task->suspend_queue;
-
-                    queue_remove((queue_t **)&(task->suspend_queue), (queue_t *)t);
-                    task->status = READY;
-                    queue_append((queue_t **)&ready_queue, (queue_t *)t);
-                }
-
-                free(task->context.uc_stack.ss_sp);
-                break;
-            default:
-                break;
+            run_task(task);
+            kernel_lock--;
+        } else if (deferred > 0) {
+            kernel_lock--;
+        } else {
+            kernel_lock--;
+
+            if (reclaim_delay > 0 && smp_cpus == 1 && !stack_check) {
+                reclaim_stacks();
+            }
+
+            if (tickless) {
+                timer_update(next_wakeup);
             }
+
+            cpu_idle();
         }
     }
 
 #ifdef DEBUG
-    queue_print("### [ready_queue] ", (queue_t *)ready_queue, print_elem);
+    sched->print();
 #endif
 
+    // as demais cpus apenas encerram a sua thread
+    if (cpu_id != 0) {
+        return;
+    }
+
     task_exit(0); // encerra o dispatcher
 }
 
 void ppos_init() {
+    char *name = getenv("PPOS_SCHED");
+    int policy = POLICY_PRIO;
+
+    // a política pode ser escolhida pela variável de ambiente PPOS_SCHED
+    if (name != NULL && (policy = sched_policy_byname(name)) < 0) {
+        fprintf(stderr, "### Erro: política de escalonamento %s desconhecida\n", name);
+        policy = POLICY_PRIO;
+    }
+
+    // o número de cpus pode ser escolhido pela variável de ambiente PPOS_CPUS
+    if ((name = getenv("PPOS_CPUS")) != NULL) {
+        smp_cpus = atoi(name);
+    }
+
+    // o modo sem ticks é ativado pela variável de ambiente PPOS_TICKLESS
+    if ((name = getenv("PPOS_TICKLESS")) != NULL) {
+        tickless = atoi(name) != 0;
+    }
+
+    // o cache de pilhas é dimensionado pela variável PPOS_STACK_POOL
+    if ((name = getenv("PPOS_STACK_POOL")) != NULL) {
+        stack_pool_max = atoi(name);
+    }
+
+    // o tempo de bloqueio que leva à devolução das pilhas é dado pela
+    // variável PPOS_STACK_RECLAIM
+    if ((name = getenv("PPOS_STACK_RECLAIM")) != NULL) {
+        reclaim_delay = atoi(name);
+    }
+
+    // a medição do uso das pilhas é ativada pela variável PPOS_STACK_CHECK
+    if ((name = getenv("PPOS_STACK_CHECK")) != NULL) {
+        stack_check = atoi(name) != 0;
+    }
+
+    // os relatórios de uso (ociosidade, pilhas, pools, laços paralelos,
+    // pipelines e micro-tarefas) são ativados pela variável PPOS_STATS
+    if ((name = getenv("PPOS_STATS")) != NULL) {
+        print_stats = atoi(name) != 0;
+    }
+
+    // as micro-tarefas executadas entre duas escolhas do dispatcher são
+    // limitadas pela variável PPOS_DEFER_BUDGET
+    if ((name = getenv("PPOS_DEFER_BUDGET")) != NULL && atoi(name) > 0) {
+        defer_budget = atoi(name);
+    }
+
+    ppos_init_policy(policy);
+}
+
+void ppos_init_smp(int cpus) {
+    smp_cpus = cpus;
+    ppos_init_policy(POLICY_PRIO);
+}
+
+void ppos_init_shards(int shards) {
+    smp_sharded = 1;
+    ppos_init_smp(shards);
+}
+
+void ppos_init_policy(sched_policy_t policy) {
+    if ((sched = sched_class(policy)) == NULL) {
+        fprintf(stderr, "### Erro: política de escalonamento inválida\n");
+        exit(1);
+    }
+
+    if (smp_cpus < 1 || smp_cpus > MAX_CPUS) {
+        fprintf(stderr, "### Erro: número de cpus inválido (1 a %d)\n", MAX_CPUS);
+        exit(1);
+    }
+
+    // com várias cpus as tarefas prontas ficam nas filas de cada cpu
+    if (smp_cpus > 1) {
+        sched = &smp_class;
+    }
+
+    // o temporizador programado por evento é único, só há uma cpu
+    if (tickless && smp_cpus > 1) {
+        fprintf(stderr, "### Erro: modo sem ticks requer uma única cpu\n");
+        tickless = 0;
+    }
+
     // desativa o buffer da saída padrão (stdout)
     setvbuf(stdout, NULL, _IONBF, 0);
 
-    // registra a ação para o sinal de timer SIGALRM
-    action.sa_handler = (void *)tick_handler;
+    // registra a ação para o sinal de timer SIGALRM e, com várias cpus, para
+    // o sinal que repassa os ticks às demais cpus
+    action.sa_handler = tick_handler;
     sigemptyset(&action.sa_mask);
+    sigaddset(&action.sa_mask, SIGALRM);
+    sigaddset(&action.sa_mask, SMP_TICK_SIGNAL);
     action.sa_flags = 0;
 
-    if (sigaction(SIGALRM, &action, NULL) < 0) {
+    if (sigaction(SIGALRM, &action, NULL) < 0 ||
+        (smp_cpus > 1 && sigaction(SMP_TICK_SIGNAL, &action, NULL) < 0)) {
         perror("Erro ao configurar ação");
         exit(1);
     }
 
-    // programa e arma um temporizador para disparar a cada 1 milissegundo
+    // programa e arma um temporizador para disparar a cada 1 milissegundo; no
+    // modo sem ticks o dispatcher programa cada disparo
     timer.it_value.tv_usec = 1000;
     timer.it_value.tv_sec = 0;
     timer.it_interval.tv_usec = 1000;
     timer.it_interval.tv_sec = 0;
 
-    if (setitimer(ITIMER_REAL, &timer, NULL) < 0) {
-        perror("Erro ao armar o temporizador");
-        exit(1);
+    if (tickless) {
+        clock_gettime(CLOCK_MONOTONIC, &boot);
     }
 
+    // a main já está na fila de prontas, mas ainda não foi escolhida: um tick
+    // até a troca para o dispatcher a retiraria da fila sem que ela deixasse
+    // de executar, e ela nunca mais seria escolhida
+    kernel_lock++;
+
     task_create(&main_task, NULL, NULL); // tarefa main (task 0)
     current_task = &main_task;           // tarefa main é a corrente
 
     // cria a tarefa dispatcher
     task_create(&dispatcher_task, (void *)dispatcher, NULL);
 
+    // os ticks só começam quando já há uma tarefa corrente
+    if (!tickless && setitimer(ITIMER_REAL, &timer, NULL) < 0) {
+        perror("Erro ao armar o temporizador");
+        exit(1);
+    }
+
 #ifdef DEBUG
     printf("%-18s: sistema inicializado\n", "### (ppos_init)");
 #endif
 
     task_switch(&dispatcher_task);
+    kernel_lock--;
 }
 
-int task_create(task_t *task, void (*start_func)(void *), void *arg) {
-    // aloca memória para a pilha utilizada pelo contexto
-    char *stack = malloc(STACKSIZE);
+// cria uma tarefa na cpu indicada; a pilha só é alocada na primeira ativação
+// (task_start), de forma que tarefas ainda não executadas não a ocupam. Os
+// campos block e detached são preparados por quem fornece o descritor.
+static int task_init(task_t *task, int cpu, task_attr_t *attr, void (*start_func)(void *), void *arg,
+                     int ready) {
+    size_t size = attr != NULL && attr->stack_size > 0 ? attr->stack_size : STACKSIZE;
 
-    if (stack == NULL) {
-        perror("Erro ao criar a pilha de sinais");
+    if (cpu < 0 || cpu >= smp_cpus) {
         return -1;
     }
 
+    // as tarefas copy_stack guardam endereços da pilha compartilhada e não
+    // podem migrar para outra cpu
+    if (attr != NULL && attr->copy_stack && (smp_cpus > 1 || shared_init() < 0)) {
+        return -1;
+    }
+
+    if (size < STACK_MIN_SIZE) {
+        size = STACK_MIN_SIZE;
+    }
+
+#ifndef FAST_SWITCH
     if (getcontext(&(task->context)) == -1) {
         perror("Erro ao armazenar o contexto atual");
         return -1;
     }
+#endif
 
     // inicializa as propriedades da nova tarefa
     task->prev = NULL;
     task->next = NULL;
-    task->id = next_id++;
+    task->id = __sync_fetch_and_add(&next_id, 1);
     task->status = NEW;
     task->static_prio = 0;
     task->dynamic_prio = 0;
+    task->vruntime = 0;
+    task->heap_index = -1;
+    task->cpu = cpu;
+    task->on_cpu = 0;
+    task->lock_depth = 0;
+    task->rt_deadline = 0;
+    task->rt_period = 0;
+    task->rt_jobs = 0;
+    task->rt_open = 0;
+    task->background = 0;
+    task->deadline_misses = 0;
+    task->lateness = 0;
+    task->max_lateness = 0;
     task->activations = 0;
-    task->exec_start = clock;
+    task->suspend_queue = NULL;
+    task->resume = NULL;
+    task->proc_time = 0;
+    clock_update();
+    task->exec_start = sys_clock;
 
     // se dispatcher (id = 1) a tarefa é do sistema; senão tarefa do usuário
     task->is_sys_task = task->id == 1 ? 1 : 0;
 
-    task->context.uc_stack.ss_sp = stack;
-    task->context.uc_stack.ss_size = STACKSIZE;
+    task->context.uc_stack.ss_sp = slab_stack(task);
+    task->context.uc_stack.ss_size = stack_size(size);
     task->context.uc_stack.ss_flags = 0;
     task->context.uc_link = NULL;
 
-    // insere as tarefas do usuário na fila de prontas
-    if (!task->is_sys_task) {
-        user_tasks++;
-        task->status = READY;
-        queue_append((queue_t **)&ready_queue, (queue_t *)task);
+    task->start_func = start_func;
+    task->arg = arg;
+    task->name = attr != NULL ? attr->name : NULL;
+    task->copy_stack = attr != NULL && attr->copy_stack;
+    task->stack_copy = NULL;
+    task->copy_size = 0;
+    task->copy_capacity = 0;
+
+    if (task->copy_stack) {
+        task->context.uc_stack.ss_sp = shared_stack;
+        task->context.uc_stack.ss_size = SHARED_STACKSIZE;
     }
 
-    makecontext(&(task->context), (void *)start_func, 1, (char *)arg);
+    if (attr != NULL) {
+        task_setprio(task, attr->prio);
+    }
+
+    list_insert(task);
+
+    // a tarefa só entra na fila depois de pronta, pois outra cpu pode
+    // escolhê-la imediatamente; a tarefa criada suspensa só executa quando
+    // outra lhe entrega o processador (task_handoff)
+    if (!task->is_sys_task) {
+        __sync_fetch_and_add(&user_tasks, 1);
+
+        if (ready) {
+            ready_append(task);
+        } else {
+            task->status = SUSPENDED;
+        }
+    }
 
 #ifdef DEBUG
     if (start_func)
@@ -247,58 +1099,354 @@ int task_create(task_t *task, void (*start_func)(void *), void *arg) {
     return task->id;
 }
 
+int task_create(task_t *task, void (*start_func)(void *), void *arg) {
+    return task_create_on(task, cpu_id, start_func, arg);
+}
+
+int task_create_on(task_t *task, int cpu, void (*start_func)(void *), void *arg) {
+    task->block = NULL;
+    task->detached = 0;
+
+    return task_init(task, cpu, NULL, start_func, arg, 1);
+}
+
+int task_create_ex(task_t *task, task_attr_t *attr, void (*start_func)(void *), void *arg) {
+    task->block = NULL;
+    task->detached = 0;
+
+    return task_init(task, cpu_id, attr, start_func, arg, 1);
+}
+
+// cria uma tarefa suspensa, fora da fila de prontas; usada pelos geradores
+int task_create_suspended(task_t *task, void (*start_func)(void *), void *arg) {
+    task->block = NULL;
+    task->detached = 0;
+
+    return task_init(task, cpu_id, NULL, start_func, arg, 0);
+}
+
+task_t *task_spawn(void (*start_func)(void *), void *arg) {
+    task_t *task = slab_alloc();
+
+    if (task == NULL) {
+        return NULL;
+    }
+
+    task->detached = 0;
+
+    if (task_init(task, cpu_id, NULL, start_func, arg, 1) < 0) {
+        slab_free(task);
+        return NULL;
+    }
+
+    return task;
+}
+
+int task_spawn_n(task_t *tasks[], int n, void (*start_func)(void *), void *args[]) {
+    if (n <= 0) {
+        return -1;
+    }
+
+    task_t *block = slab_alloc_n(n);
+
+    if (block == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        // sem o vetor tasks, ninguém pode aguardar as tarefas
+        block[i].detached = tasks == NULL;
+
+        if (task_init(&block[i], cpu_id, NULL, start_func, args != NULL ? args[i] : NULL, 1) < 0) {
+            // os descritores não usados são devolvidos, para que o bloco
+            // seja desfeito junto com as tarefas já criadas
+            for (int j = i; j < n; j++) {
+                slab_free(&block[j]);
+            }
+
+            return i > 0 ? i : -1;
+        }
+
+        if (tasks != NULL) {
+            tasks[i] = &block[i];
+        }
+    }
+
+    return n;
+}
+
+int task_detach(task_t *task) {
+    if (task == NULL || task->block == NULL || task->detached) {
+        return -1;
+    }
+
+    // task_done libera o descritor se a tarefa ainda não terminou
+    enter_cs(&join_lock);
+    task->detached = 1;
+    int finished = task->status == FINISHED;
+    leave_cs(&join_lock);
+
+    if (finished) {
+        slab_free(task);
+    }
+
+    return 0;
+}
+
+// cria o descritor de uma corrotina, retomada por resume(task); arg fica à
+// disposição de resume
+task_t *coro_spawn(int (*resume)(task_t *task), void *arg) {
+    task_t *task = slab_alloc();
+
+    if (task == NULL) {
+        return NULL;
+    }
+
+    task->detached = 0;
+
+    // a corrotina só entra na fila de prontas depois de marcada como tal
+    if (task_init(task, cpu_id, NULL, NULL, arg, 0) < 0) {
+        slab_free(task);
+        return NULL;
+    }
+
+    task->resume = resume;
+    ready_append(task);
+
+    return task;
+}
+
+// destaca o descritor de uma corrotina: se ela já terminou, o descritor é
+// liberado e retorna 1; senão, retorna 0 e o descritor e o quadro são
+// liberados no seu término
+int coro_detach(task_t *task) {
+    enter_cs(&join_lock);
+    task->detached = 1;
+    int finished = task->status == FINISHED;
+    leave_cs(&join_lock);
+
+    if (finished) {
+        slab_free(task);
+    }
+
+    return finished;
+}
+
+// prepara a primeira ativação de uma tarefa: aloca a sua pilha e monta o
+// contexto inicial, que começa por task_entry
+static void task_start(task_t *task) {
+    char *stack = task->context.uc_stack.ss_sp;
+
+    // as tarefas de task_spawn_n já têm a pilha reservada no seu bloco
+    if (stack == NULL) {
+        stack = stack_alloc(task->context.uc_stack.ss_size);
+    }
+
+    if (stack == NULL) {
+        perror("Erro ao criar a pilha da tarefa");
+        exit(1);
+    }
+
+    task->context.uc_stack.ss_sp = stack;
+
+    // a pilha é pintada antes de receber o contexto inicial
+    if (stack_check) {
+        stack_paint(stack, task->context.uc_stack.ss_size);
+    }
+
+#ifdef FAST_SWITCH
+    ctx_make(task, (void (*)(void *))task_entry, NULL);
+#else
+    makecontext(&(task->context), task_entry, 0);
+#endif
+}
+
 int task_switch(task_t *task) {
     task_t *t = current_task;
+    char mark; // delimita a parte usada da pilha da tarefa que sai
+
+    // a pilha de uma tarefa só é alocada na sua primeira ativação; a main,
+    // sem corpo, executa na pilha do processo e as tarefas copy_stack na
+    // pilha compartilhada. O teste usa apenas campos da segunda linha de
+    // cache do descritor, não o contexto.
+    if (task->activations == 0 && task->start_func != NULL && !task->copy_stack) {
+        task_start(task);
+    }
+
+    // sem ticks, o processamento da tarefa que sai só é contabilizado aqui
+    if (tickless) {
+        clock_update();
+        account(t);
+    }
+
     current_task = task;
+    prev_task = t;
+    t->lock_depth = kernel_lock;
 
     task->activations++;
-    task->proc_marker = clock;
+    task->proc_marker = sys_clock;
 
 #ifdef DEBUG
     printf("%-18s: tarefa %d -> tarefa %d\n", "### (task_switch)", t->id, task->id);
 #endif
 
+    // a parte usada da pilha inclui o que a troca de contexto empilha
+    // abaixo daqui
+    t->stack_low = &mark - STACK_LOW_MARGIN;
+
+    // uma tarefa copy_stack só executa depois de instalada na pilha
+    // compartilhada; se a tarefa que sai estiver nela, a troca do conteúdo
+    // é feita pelo copiador, na sua própria pilha
+    if (task->copy_stack && shared_owner != task) {
+        if (t == shared_owner) {
+            copier_next = task;
+#ifdef FAST_SWITCH
+            ctx_switch(&t->stack_ptr, copier_task.stack_ptr);
+#else
+            swapcontext(&(t->context), &copier_task.context);
+#endif
+            finish_switch();
+
+            return 0;
+        }
+
+        shared_save();
+        shared_restore(task);
+    }
+
+#ifdef FAST_SWITCH
+    ctx_switch(&t->stack_ptr, task->stack_ptr);
+#else
     if (swapcontext(&(t->context), &(task->context)) == -1) {
         perror("Erro ao trocar de contexto");
         return -1;
     }
+#endif
+
+    finish_switch();
 
     return 0;
 }
 
+// contabiliza o término da ativação corrente de uma tarefa de tempo real
+static void job_done(task_t *task) {
+    task->rt_jobs++;
+
+    if ((int)(sys_clock - task->deadline) > 0) {
+        unsigned int late = sys_clock - task->deadline;
+
+        task->deadline_misses++;
+        task->lateness += late;
+
+        if (late > task->max_lateness) {
+            task->max_lateness = late;
+        }
+    }
+}
+
+// imprime as estatísticas de uma tarefa que terminou
+static void task_report(task_t *task) {
+    // tempo de execução da tarefa
+    unsigned int exec_time = task->exec_end - task->exec_start;
+
+    // uso máximo da pilha até aqui, se medido; a main usa a pilha do processo
+    // e as corrotinas não têm pilha
+    char stack[32] = "";
+
+    if (stack_check && task->context.uc_stack.ss_sp != NULL && !task->copy_stack) {
+        snprintf(stack, sizeof(stack), ", stack %zu bytes",
+                 stack_usage(task->context.uc_stack.ss_sp, task->context.uc_stack.ss_size));
+    }
+
+    if (task->name != NULL) {
+        printf("Task %d (%s) exit: execution time %4u ms, processor time %4u ms, %d activations%s\n",
+               task->id, task->name, exec_time, task->proc_time, task->activations, stack);
+    } else {
+        printf("Task %d exit: execution time %4u ms, processor time %4u ms, %d activations%s\n",
+               task->id, exec_time, task->proc_time, task->activations, stack);
+    }
+}
+
 void task_exit(int exit_code) {
 #ifdef DEBUG
     printf("%-18s: tarefa %d finalizada\n", "### (task_exit)", current_task->id);
 #endif
 
-    current_task->status = FINISHED;
+    // uma micro-tarefa executa na pilha do dispatcher e não pode encerrá-lo
+    if (deferring) {
+        return;
+    }
+
+    // sem ticks, o processamento desde o último evento ainda não foi contado
+    if (tickless) {
+        clock_update();
+        account(current_task);
+    }
+
     current_task->exit_code = exit_code;
-    current_task->exec_end = clock;
+    current_task->exec_end = sys_clock;
 
-    // tempo de execução da tarefa
-    unsigned int exec_time = current_task->exec_end - current_task->exec_start;
+    task_report(current_task);
+
+    // a ativação iniciada por task_setdeadline e não concluída por
+    // task_waitperiod termina com a tarefa; a liberada pelo último
+    // task_waitperiod é abandonada, sem contar como ativação nem como perda
+    if (current_task->rt_deadline > 0) {
+        if (current_task->rt_open) {
+            job_done(current_task);
+        }
+
+        printf("Task %d deadlines: %d jobs, %d misses, lateness %u ms total, %u ms max\n",
+               current_task->id, current_task->rt_jobs, current_task->deadline_misses,
+               current_task->lateness, current_task->max_lateness);
+    }
 
-    printf("Task %d exit: execution time %4u ms, processor time %4u ms, %d activations\n",
-           current_task->id, exec_time, current_task->proc_time, current_task->activations);
+    // a tarefa ainda executa na sua pilha e o seu contexto será salvo no seu
+    // descritor: o encerramento é concluído pela tarefa que entrar na cpu
+    kernel_lock++;
+    dead_task = current_task;
 
     if (current_task == &dispatcher_task) {
+        if (print_stats) {
+            printf("Idle time: %u ms, %u timer interrupts\n", idle_time, interrupts);
+        }
+        stack_print();
+        if (print_stats) {
+            parallel_print();
+            defer_print();
+        }
+
+        // a main pode ter terminado há pouco em outra cpu
+        while (__atomic_load_n(&main_task.on_cpu, __ATOMIC_ACQUIRE))
+            ;
+
         task_switch(&main_task);
     } else {
-        user_tasks--;
-        task_switch(&dispatcher_task);
+        if (!current_task->background) {
+            __sync_fetch_and_sub(&user_tasks, 1);
+        }
+        reschedule();
     }
+    kernel_lock--;
 }
 
 int task_id() {
     return current_task->id;
 }
 
-void task_yield() {
+int task_yield() {
+    // uma micro-tarefa executa no dispatcher e não pode ceder o processador
+    if (current_task == cpu_dispatcher) {
+        return -1;
+    }
+
 #ifdef DEBUG
     printf("%-18s: tarefa %d liberou a CPU\n", "### (task_yield)", current_task->id);
 #endif
 
-    task_switch(&dispatcher_task);
+    reschedule();
+
+    return 0;
 }
 
 void task_setprio(task_t *task, int prio) {
@@ -310,12 +1458,13 @@ void task_setprio(task_t *task, int prio) {
     }
 
     if (task == NULL) {
-        current_task->static_prio = prio;
-        current_task->dynamic_prio = prio;
-    } else {
-        task->static_prio = prio;
-        task->dynamic_prio = prio;
+        task = current_task;
     }
+
+    // a política reposiciona a tarefa, caso ela esteja pronta
+    kernel_lock++;
+    task_class(task)->on_setprio(task, prio);
+    kernel_lock--;
 }
 
 int task_getprio(task_t *task) {
@@ -327,24 +1476,142 @@ int task_getprio(task_t *task) {
 }
 
 int task_join(task_t *task) {
-    if (task->status == FINISHED || task == NULL) {
+    if (task == NULL || task->detached || current_task == cpu_dispatcher) {
         return -1;
     }
 
-    current_task->status = SUSPENDED;
-    queue_append((queue_t **)&(task->suspend_queue), (queue_t *)current_task);
-    task_switch(&dispatcher_task);
+    // o término da tarefa e o esvaziamento da sua fila de suspensas ocorrem
+    // sob a mesma trava, para que nenhuma tarefa fique esperando para sempre
+    enter_cs(&join_lock);
+    if (task->status != FINISHED) {
+        current_task->status = SUSPENDED;
+        queue_append((queue_t **)&(task->suspend_queue), (queue_t *)current_task);
+        leave_cs(&join_lock);
+
+        reschedule();
+    } else if (task->block == NULL) {
+        leave_cs(&join_lock);
+        return -1;
+    } else {
+        leave_cs(&join_lock);
+    }
 
-    return task->exit_code;
+    int exit_code = task->exit_code;
+
+    // o descritor de task_spawn é liberado pela tarefa que o aguardou
+    if (task->block != NULL) {
+        slab_free(task);
+    }
+
+    return exit_code;
 }
 
-void task_sleep(int t) {
-    current_task->wakeup_time = clock + t;
-    current_task->status = SLEEPING;
-    queue_append((queue_t **)&sleep_queue, (queue_t *)current_task);
-    task_switch(&dispatcher_task);
+// suspende a tarefa na fila do join de task, sem trocar de contexto; retorna
+// 1 se a tarefa foi suspensa e 0 se task já terminou. Usada pelas corrotinas.
+int task_join_async(task_t *task, task_t *waiter) {
+    int wait;
+
+    enter_cs(&join_lock);
+    if ((wait = task->status != FINISHED)) {
+        waiter->status = SUSPENDED;
+        queue_append((queue_t **)&(task->suspend_queue), (queue_t *)waiter);
+    }
+    leave_cs(&join_lock);
+
+    return wait;
+}
+
+// coloca a tarefa na fila de tarefas adormecidas desta cpu, sem trocar de
+// contexto; usada também pelas corrotinas
+void task_sleep_async(task_t *task, int t) {
+    clock_update();
+    task->wakeup_time = sys_clock + t;
+    task->status = SLEEPING;
+
+    enter_cs(&sleep_lock);
+    queue_append((queue_t **)&sleep_queue, (queue_t *)task);
+    leave_cs(&sleep_lock);
+}
+
+int task_sleep(int t) {
+    if (current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    task_sleep_async(current_task, t);
+    reschedule();
+
+    return 0;
 }
 
 unsigned int systime() {
-    return clock;
+    clock_update();
+    return sys_clock;
+}
+
+unsigned int idletime() {
+    return idle_time;
+}
+
+int task_setdeadline(task_t *task, int deadline, int period) {
+    if (task == NULL) {
+        task = current_task;
+    }
+
+    // o escalonamento de tempo real usa uma fila única, só há uma cpu
+    if (task->status == FINISHED || deadline < 0 || period < 0 || smp_cpus > 1) {
+        return -1;
+    }
+
+    // uma tarefa pronta muda de classe de escalonamento
+    kernel_lock++;
+    if (task->status == READY) {
+        task_class(task)->dequeue(task);
+    }
+
+    task->rt_deadline = deadline;
+    task->rt_period = period;
+    task->rt_open = deadline > 0;
+    clock_update();
+    task->deadline = sys_clock + deadline;
+    task->release = sys_clock + period;
+
+    if (task->status == READY) {
+        task_class(task)->enqueue(task);
+    }
+    kernel_lock--;
+
+    return 0;
+}
+
+int task_waitperiod() {
+    task_t *task = current_task;
+
+    if (task->rt_deadline == 0 || task->rt_period == 0) {
+        return -1;
+    }
+
+    clock_update();
+    job_done(task);
+    task->rt_open = 0;
+
+    // a próxima ativação começa na próxima liberação, ou imediatamente se a
+    // tarefa já a ultrapassou
+    unsigned int release = task->release;
+
+    task->deadline = release + task->rt_deadline;
+    task->release = release + task->rt_period;
+
+    if ((int)(release - sys_clock) > 0) {
+        task->wakeup_time = release;
+        task->status = SLEEPING;
+
+        enter_cs(&sleep_lock);
+        queue_append((queue_t **)&sleep_queue, (queue_t *)task);
+        leave_cs(&sleep_lock);
+
+        reschedule();
+    }
+
+    return 0;
 }
@@ -0,0 +1,387 @@
+// PingPongOS - PingPong Operating System
+
+// Corrotinas C++20 sobre o escalonador do núcleo. ppos::task<T> é uma
+// corrotina sem pilha: o seu estado fica em um quadro alocado pelo
+// compilador, de algumas centenas de bytes, e ela é retomada como uma
+// chamada de função, sem troca de contexto. Uma corrotina iniciada com
+// start() ganha um descritor do núcleo e passa a ser escalonada pelo
+// dispatcher, nas mesmas filas de prontas que as tarefas com pilha; as
+// corrotinas que ela aguarda com co_await antes de iniciadas executam dentro
+// dela, no mesmo descritor. A passagem entre elas é feita pelo laço da
+// função resume do descritor, e não por transferência simétrica, que sem
+// otimizações não é uma chamada de cauda e esgotaria a pilha.
+//
+// Dentro de uma corrotina, as operações que bloqueiam são as versões
+// aguardáveis deste arquivo (ppos::sem_down, ppos::mqueue_send,
+// ppos::mqueue_recv, ppos::task_sleep, ppos::task_yield e co_await em outra
+// corrotina); as chamadas bloqueantes do núcleo encerram o sistema com um
+// erro. As corrotinas não são preemptadas: uma corrotina executa até se
+// suspender.
+//
+// Compilar com g++ -std=c++20 e ligar com os módulos do núcleo compilados
+// pelo gcc.
+
+#ifndef __PPOS_CORO__
+#define __PPOS_CORO__
+
+// ppos.h redefine as funções POSIX proibidas, usadas pela biblioteca padrão,
+// que por isso é incluída antes
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <optional>
+#include <utility>
+
+extern "C" {
+#include "ppos.h"
+
+extern __thread task_t *current_task;
+
+task_t *coro_spawn(int (*resume)(task_t *task), void *arg);
+int coro_detach(task_t *task);
+int task_join_async(task_t *task, task_t *waiter);
+void task_sleep_async(task_t *task, int t);
+int sem_down_async(semaphore_t *s, task_t *waiter);
+void mqueue_put(mqueue_t *queue, void *msg);
+void mqueue_take(mqueue_t *queue, void *msg);
+}
+
+namespace ppos {
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+inline void transfer(std::coroutine_handle<> h);
+
+// parte da promessa que não depende do tipo do resultado; o descritor de uma
+// corrotina iniciada aponta para a promessa da sua raiz
+struct promise_base {
+    std::coroutine_handle<> self;         // a própria corrotina
+    std::coroutine_handle<> continuation; // quem a aguarda, no mesmo descritor
+    std::coroutine_handle<> leaf;         // raiz: corrotina suspensa a retomar
+    std::exception_ptr error;             // exceção não tratada pelo corpo
+    int transfer = 0;                     // raiz: leaf deve ser retomada em seguida
+    int finished = 0;                     // raiz: o corpo terminou
+
+    // a corrotina só executa quando iniciada ou aguardada
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    // ao terminar, a corrotina aguardada passa o processador a quem a
+    // aguarda; a raiz retorna ao núcleo
+    struct final_awaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> h) noexcept {
+            promise_base &p = h.promise();
+
+            if (p.continuation) {
+                detail::transfer(p.continuation);
+            } else {
+                p.finished = 1;
+            }
+        }
+
+        void await_resume() noexcept {
+        }
+    };
+
+    final_awaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        error = std::current_exception();
+    }
+};
+
+// promessa da raiz da corrotina corrente
+inline promise_base *root() {
+    return static_cast<promise_base *>(current_task->arg);
+}
+
+// a corrotina corrente se suspende para que h execute em seguida
+inline void transfer(std::coroutine_handle<> h) {
+    root()->leaf = h;
+    root()->transfer = 1;
+}
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object();
+
+    void return_value(T v) {
+        value.emplace(std::move(v));
+    }
+
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        return std::move(*value);
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object();
+
+    void return_void() {
+    }
+
+    void result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// função resume dos descritores das corrotinas: retoma as corrotinas da raiz
+// até que uma delas se suspenda no núcleo, e retorna 1 quando a raiz
+// termina. Chamada depois do término, para uma corrotina destacada, destroi
+// o quadro da raiz.
+inline int resume(task_t *task) {
+    promise_base *root = static_cast<promise_base *>(task->arg);
+
+    if (root->finished) {
+        root->self.destroy();
+        return 1;
+    }
+
+    do {
+        root->transfer = 0;
+        root->leaf.resume();
+    } while (root->transfer);
+
+    return root->finished;
+}
+
+// registra h como a corrotina a retomar e retorna o descritor corrente, a
+// ser colocado em uma fila de espera
+inline task_t *park(std::coroutine_handle<> h) {
+    root()->leaf = h;
+
+    return current_task;
+}
+
+} // namespace detail
+
+// Corrotina com resultado do tipo T. co_await em uma corrotina não iniciada
+// a executa dentro da corrotina que aguarda e retorna o seu resultado;
+// co_await em uma corrotina iniciada aguarda o seu término, como task_join.
+// Destruir uma corrotina iniciada e não terminada a destaca: o quadro e o
+// descritor são liberados no seu término.
+template <typename T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> h) : h(h) {
+    }
+
+    task(task &&other) noexcept
+        : h(std::exchange(other.h, {})), kernel(std::exchange(other.kernel, nullptr)) {
+    }
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    ~task() {
+        if (!h) {
+            return;
+        }
+
+        if (kernel == nullptr || coro_detach(kernel)) {
+            h.destroy();
+        }
+    }
+
+    // inicia a corrotina como uma tarefa do núcleo, na fila de prontas;
+    // retorna o seu id, ou -1 em caso de erro
+    int start() {
+        if (!h || kernel != nullptr || h.done()) {
+            return -1;
+        }
+
+        h.promise().leaf = h;
+        kernel = coro_spawn(detail::resume, static_cast<detail::promise_base *>(&h.promise()));
+
+        return kernel != nullptr ? kernel->id : -1;
+    }
+
+    // aguarda o término da corrotina, iniciando-a se preciso, e retorna o
+    // seu resultado; usada pelas tarefas com pilha
+    T join() {
+        if (kernel == nullptr && !h.done() && start() < 0) {
+            perror("Erro ao iniciar a corrotina");
+            exit(1);
+        }
+
+        // task_join libera o descritor
+        if (kernel != nullptr) {
+            task_join(kernel);
+            kernel = nullptr;
+        }
+
+        return h.promise().result();
+    }
+
+    struct awaiter {
+        task *t;
+
+        bool await_ready() noexcept {
+            return t->kernel == nullptr && t->h.done();
+        }
+
+        bool await_suspend(std::coroutine_handle<> caller) {
+            // não iniciada: executa aqui e devolve o processador ao terminar
+            if (t->kernel == nullptr) {
+                t->h.promise().continuation = caller;
+                detail::transfer(t->h);
+                return true;
+            }
+
+            return task_join_async(t->kernel, detail::park(caller)) > 0;
+        }
+
+        T await_resume() {
+            return t->h.promise().result();
+        }
+    };
+
+    awaiter operator co_await() noexcept {
+        return awaiter{this};
+    }
+
+private:
+    std::coroutine_handle<promise_type> h;
+    task_t *kernel = nullptr; // descritor, depois de iniciada
+};
+
+template <typename T>
+task<T> detail::promise<T>::get_return_object() {
+    self = std::coroutine_handle<promise>::from_promise(*this);
+    return task<T>(std::coroutine_handle<promise>::from_promise(*this));
+}
+
+inline task<void> detail::promise<void>::get_return_object() {
+    self = std::coroutine_handle<promise>::from_promise(*this);
+    return task<void>(std::coroutine_handle<promise>::from_promise(*this));
+}
+
+// inicia a corrotina e a destaca; retorna o seu id, ou -1 em caso de erro
+template <typename T>
+int spawn(task<T> t) {
+    return t.start();
+}
+
+// aguardáveis ================================================================
+
+// cede o processador; a corrotina volta à fila de prontas
+inline auto task_yield() {
+    struct awaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+            detail::park(h);
+        }
+
+        void await_resume() noexcept {
+        }
+    };
+
+    return awaiter{};
+}
+
+// suspende a corrotina por t milissegundos
+inline auto task_sleep(int t) {
+    struct awaiter {
+        int t;
+
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+            task_sleep_async(detail::park(h), t);
+        }
+
+        void await_resume() noexcept {
+        }
+    };
+
+    return awaiter{t};
+}
+
+// como sem_down: retorna 0, ou -1 se o semáforo não existe ou foi destruído
+inline auto sem_down(semaphore_t *s) {
+    struct awaiter {
+        semaphore_t *s;
+        int wait;
+
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) noexcept {
+            wait = sem_down_async(s, detail::park(h));
+            return wait > 0;
+        }
+
+        int await_resume() noexcept {
+            return wait < 0 || s->active == 0 ? -1 : 0;
+        }
+    };
+
+    return awaiter{s, 0};
+}
+
+// como mqueue_send, com os semáforos da fila aguardados pela corrotina
+inline task<int> mqueue_send(mqueue_t *queue, void *msg) {
+    if (queue == nullptr || queue->active == 0) {
+        co_return -1;
+    }
+
+    co_await ppos::sem_down(&queue->s_space);
+    co_await ppos::sem_down(&queue->s_buffer);
+
+    mqueue_put(queue, msg);
+
+    ::sem_up(&queue->s_buffer);
+    ::sem_up(&queue->s_item);
+
+    co_return 0;
+}
+
+// como mqueue_recv, com os semáforos da fila aguardados pela corrotina
+inline task<int> mqueue_recv(mqueue_t *queue, void *msg) {
+    if (queue == nullptr || queue->active == 0) {
+        co_return -1;
+    }
+
+    co_await ppos::sem_down(&queue->s_item);
+    co_await ppos::sem_down(&queue->s_buffer);
+
+    mqueue_take(queue, msg);
+
+    ::sem_up(&queue->s_buffer);
+    ::sem_up(&queue->s_space);
+
+    co_return 0;
+}
+
+} // namespace ppos
+
+#endif
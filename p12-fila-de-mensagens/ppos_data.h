@@ -6,11 +6,29 @@
 #include "queue.h"    // biblioteca de filas genéricas
 #include <ucontext.h> // biblioteca POSIX de trocas de contexto
 
-#define STACKSIZE 32768  // tamanho da pilha de threads
+#define STACKSIZE 32768  // tamanho padrão da pilha de threads
+#define STACK_MIN_SIZE 16384 // menor pilha aceita por task_create_ex
+#define SHARED_STACKSIZE 262144 // pilha compartilhada pelas tarefas copy_stack
+#define STACK_POOL 64    // pilhas livres guardadas em cada faixa de tamanho
+#define RECLAIM_DELAY 1000 // bloqueio (ms) após o qual a pilha livre é devolvida
+#define FUTURE_BLOB 64   // maior valor copiado para dentro de um futuro
+#define PARALLEL_GRAIN 2 // duração (ms) visada para cada parte de task_parallel_for
+#define PIPELINE_STAGES 16 // máximo de estágios de um pipeline
+#define PIPELINE_BATCH 32 // itens transferidos de uma vez entre estágios
+#define DEFER_BUDGET 128 // micro-tarefas executadas entre duas escolhas do dispatcher
 #define AGING_FACTOR -1  // fator de envelhecimento
 #define MIN_PRIORITY 20  // prioridade mínima
 #define MAX_PRIORITY -20 // prioridade máxima
+#define PRIO_LEVELS (MIN_PRIORITY - MAX_PRIORITY + 1) // níveis de prioridade
 #define TICKS 10         // quantum
+#define MAX_CPUS 64      // máximo de cpus (threads do sistema)
+#define SMP_TICK_SIGNAL SIGUSR1 // repassa os ticks do relógio às demais cpus
+
+// troca de contexto em assembly nas arquiteturas suportadas (ppos_switch.c);
+// compilar com -DPPOS_SWAPCONTEXT força o uso de swapcontext
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(PPOS_SWAPCONTEXT)
+#define FAST_SWITCH
+#endif
 
 // tipo enumerado que define os possíveis valores para o status da tarefa
 typedef enum { NEW,
@@ -20,25 +38,99 @@ typedef enum { NEW,
                SLEEPING,
                FINISHED } status_t;
 
-// Estrutura que define um Task Control Block (TCB)
+// tipo enumerado que define as políticas de escalonamento disponíveis
+typedef enum { POLICY_PRIO,  // prioridades dinâmicas com envelhecimento
+               POLICY_FAIR,  // divisão justa por tempo virtual ponderado
+               POLICY_RR,    // circular, sem prioridades
+               POLICY_STRIDE // escalonamento por passos (stride)
+} sched_policy_t;
+
+// Estrutura que define um Task Control Block (TCB). Os campos são agrupados
+// pela frequência de uso: a primeira linha de cache (bytes 0 a 63) tem tudo
+// o que as filas de prontas e as políticas de escalonamento consultam, a
+// segunda (64 a 127) o que a troca de contexto usa, e o restante, a partir
+// do id (byte 128) e com o contexto ucontext_t (quase 1 KB) no final, só
+// é tocado na criação, no bloqueio, no encerramento e na contabilização. Não
+// foi medida redução de tempo com esse agrupamento: em pingpong-dispatch a
+// diferença ficou dentro do ruído.
 typedef struct task_t {
-    struct task_t *prev, *next;   // ponteiros para usar em filas
-    struct task_t *suspend_queue; // fila de tarefas suspensas
-    int id;                       // identificador da tarefa
-    ucontext_t context;           // contexto armazenado da tarefa
-    status_t status;              // status da tarefa
-    int static_prio;              // prioridade estática
-    int dynamic_prio;             // prioridade dinâmica
-    int is_sys_task;              // flag de tarefa do sistema
-    int quantum;                  // total de ticks do relógio
-    int activations;              // contador de ativações
-    int exit_code;                // código de encerramento da tarefa
-    int wakeup_time;              // tempo no qual a tarefa deve acordar
-    unsigned int exec_start;      // tempo de início de execução da tarefa
-    unsigned int exec_end;        // tempo de término de execução da tarefa
-    unsigned int proc_marker;     // marcador de tempo parcial de processamento
-    unsigned int proc_time;       // tempo total de processamento
-} task_t;
+    // escalonamento (primeira linha de cache)
+    struct task_t *prev, *next;     // ponteiros para usar em filas
+    unsigned long long ready_epoch; // época de escalonamento ao ficar pronta
+    unsigned long long vruntime;    // tempo virtual de processamento
+    status_t status;                // status da tarefa
+    int static_prio;                // prioridade estática
+    int dynamic_prio;               // prioridade dinâmica ao ficar pronta
+    int quantum;                    // total de ticks do relógio
+    int heap_index;                 // posição no heap da política justa
+    int cpu;                        // cpu em cuja fila de prontas a tarefa está
+    int on_cpu;                     // contexto em uso por uma cpu
+    int lock_depth;                 // kernel_lock salvo na troca de contexto
+
+    // troca de contexto (segunda linha de cache)
+    void *stack_ptr;                // pilha salva pela troca de contexto rápida
+    void *stack_low;                // início da parte usada da pilha, fora da cpu
+    void (*start_func)(void *);     // corpo da tarefa
+    int (*resume)(struct task_t *); // retoma a corrotina; NULL nas tarefas com pilha
+    void *arg;                      // argumento do corpo da tarefa
+    int activations;                // contador de ativações
+    unsigned int proc_marker;       // marcador de tempo parcial de processamento
+    int is_sys_task;                // flag de tarefa do sistema
+    int copy_stack;                 // executa na pilha compartilhada
+    unsigned int deadline;          // prazo absoluto da ativação corrente
+    int rt_deadline;                // prazo relativo (ms); 0 se não for de tempo real
+
+    // criação, bloqueio, encerramento e contabilização
+    int id;                         // identificador da tarefa
+    unsigned int wakeup_time;       // tempo no qual a tarefa deve acordar
+    unsigned int ready_seq;         // ordem de chegada à fila de prontas por prioridades
+    struct task_t *suspend_queue;   // fila de tarefas suspensas
+    const char *name;               // nome da tarefa (opcional)
+    void *stack_copy;               // parte usada salva fora da pilha compartilhada
+    size_t copy_size;               // bytes salvos em stack_copy
+    size_t copy_capacity;           // capacidade de stack_copy
+    struct task_t *list_prev;       // lista de todas as tarefas
+    struct task_t *list_next;
+    void *block;                    // bloco do núcleo com o descritor; NULL se do usuário
+    int detached;                   // descritor liberado no término, sem task_join
+    int background;                 // não impede o encerramento do sistema
+    int exit_code;                  // código de encerramento da tarefa
+    unsigned int blocked_since;     // instante do último bloqueio
+    int reclaimed;                  // pilha já devolvida neste bloqueio
+    unsigned int exec_start;        // tempo de início de execução da tarefa
+    unsigned int exec_end;          // tempo de término de execução da tarefa
+    unsigned int proc_time;         // tempo total de processamento
+    int rt_period;                  // período de liberação (ms); 0 se aperiódica
+    unsigned int release;           // instante da próxima liberação periódica
+    int rt_jobs;                    // ativações de tempo real concluídas
+    int rt_open;                    // ativação de task_setdeadline ainda não concluída
+    int deadline_misses;            // ativações concluídas após o prazo
+    unsigned int lateness;          // atraso total das ativações (ms)
+    unsigned int max_lateness;      // maior atraso de uma ativação (ms)
+    ucontext_t context;             // contexto armazenado da tarefa
+} __attribute__((aligned(64))) task_t;
+
+// atributos de uma nova tarefa, para task_create_ex
+typedef struct
+{
+    size_t stack_size; // tamanho da pilha; 0 para STACKSIZE
+    int prio;          // prioridade estática inicial
+    const char *name;  // nome da tarefa (opcional)
+    int copy_stack;    // executa na pilha compartilhada (uma única cpu)
+} task_attr_t;
+
+// operações que definem uma política de escalonamento; o núcleo chama estas
+// operações com a preempção desabilitada
+typedef struct
+{
+    const char *name;                                  // nome da política
+    void (*enqueue)(task_t *task);                     // insere na fila de prontas
+    void (*dequeue)(task_t *task);                     // retira da fila de prontas
+    task_t *(*pick_next)(void);                        // escolhe e retira a próxima
+    void (*on_tick)(task_t *task, unsigned int ticks); // contabiliza ticks
+    void (*on_setprio)(task_t *task, int prio);        // altera a prioridade
+    void (*print)(void);                               // imprime a fila (depuração)
+} sched_class_t;
 
 // estrutura que define um semáforo
 typedef struct
@@ -75,4 +167,141 @@ typedef struct
     semaphore_t s_space;
 } mqueue_t;
 
+// estrutura que define uma fila de mensagens entre cpus: um anel sem travas
+// com um único produtor e um único consumidor; cada índice é escrito por um
+// só lado e fica em sua própria linha de cache, junto com a tarefa daquele
+// lado que aguarda o outro. A trava só é usada para suspender e acordar.
+typedef struct
+{
+    void *buffer;  // buffer circular
+    int active;    // flag de ativação
+    int capacity;  // capacidade do buffer (potência de 2)
+    int item_size; // tamanho do tipo de dado
+    int lock;      // protege a suspensão e o despertar das tarefas
+    unsigned int head __attribute__((aligned(64))); // próxima leitura (consumidor)
+    struct task_t *receiver;                        // consumidor aguardando mensagem
+    unsigned int tail __attribute__((aligned(64))); // próxima escrita (produtor)
+    struct task_t *sender;                          // produtor aguardando espaço
+} xqueue_t;
+
+// trabalho submetido a um pool de tarefas
+typedef struct job_t {
+    struct job_t *next;     // próximo trabalho da fila ou da lista de livres
+    void (*func)(void *);   // função do trabalho
+    void *arg;              // argumento da função
+    int prio;               // prioridade do trabalho
+    unsigned int submitted; // instante da submissão
+} job_t;
+
+// estrutura que define um pool de tarefas: um conjunto fixo de tarefas que
+// executam os trabalhos submetidos, por ordem de prioridade
+typedef struct
+{
+    task_t **workers;               // tarefas do pool
+    int size;                       // número de tarefas
+    int active;                     // flag de ativação
+    int lock;                       // protege as filas e os contadores
+    job_t *head[PRIO_LEVELS];       // filas de trabalhos, uma por prioridade
+    job_t *tail[PRIO_LEVELS];       // últimos trabalhos de cada fila
+    unsigned long long map;         // filas não vazias
+    job_t *free_jobs;               // trabalhos já concluídos, para reutilização
+    int pending;                    // trabalhos submetidos e não concluídos
+    int waiting;                    // tarefas em task_pool_wait
+    semaphore_t s_jobs;             // trabalhos nas filas
+    semaphore_t s_idle;             // libera as tarefas em task_pool_wait
+    unsigned int jobs;              // trabalhos concluídos
+    int depth;                      // trabalhos nas filas
+    int max_depth;                  // maior número de trabalhos nas filas
+    unsigned long long depth_sum;   // soma de depth a cada submissão
+    unsigned long long latency_sum; // soma das esperas nas filas (ms)
+    unsigned int max_latency;       // maior espera nas filas (ms)
+} task_pool_t;
+
+// estados de um futuro
+typedef enum { FUTURE_PENDING, // valor ainda não definido
+               FUTURE_SETTING, // valor definido, continuações em execução
+               FUTURE_READY } future_state_t; // valor disponível para future_get
+
+// continuação registrada com future_then
+typedef struct future_cont_t {
+    struct future_cont_t *next;             // próxima continuação
+    void *(*func)(void *value, void *arg);  // função aplicada ao valor
+    void *arg;                              // argumento da função
+    struct future_t *result;                // futuro que recebe o seu resultado
+} future_cont_t;
+
+// estrutura que define um futuro: um valor definido uma única vez, pela
+// tarefa de task_async ou por future_set, e aguardado com future_get
+typedef struct future_t {
+    int active;              // flag de ativação
+    int lock;                // protege o estado, as continuações e a fila
+    future_state_t state;    // estado do valor
+    int allocated;           // alocado pelo núcleo (task_async, future_then)
+    void *value;             // valor do futuro
+    void *(*func)(void *);   // corpo da tarefa de task_async
+    void *arg;               // argumento do corpo
+    future_cont_t *conts;    // continuações pendentes
+    task_t *task_queue;      // tarefas aguardando o valor
+    int waiters;             // tarefas suspensas em future_get, ainda não retomadas
+    char blob[FUTURE_BLOB] __attribute__((aligned(16))); // valor copiado
+} future_t;
+
+// estrutura que define um gerador: uma tarefa que produz valores sob demanda
+// para uma tarefa consumidora; as duas trocam o processador diretamente a
+// cada valor
+typedef struct
+{
+    task_t task;          // tarefa do gerador
+    int active;           // flag de ativação
+    int done;             // o corpo do gerador terminou
+    int cancel;           // destruído antes do fim do corpo
+    task_t *consumer;     // tarefa que aguarda o próximo valor
+    void *value;          // último valor produzido
+    void (*func)(void *); // corpo do gerador
+    void *arg;            // argumento do corpo
+} generator_t;
+
+// corpo de um estágio de pipeline: processa o item in e escreve em out o seu
+// item de saída; retorna 1 se produziu um item ou 0 se descartou a entrada.
+// Nos estágios sem entrada (fontes) in é NULL e o retorno 0 encerra o
+// worker; nos estágios sem saída out é NULL.
+typedef int (*stage_func_t)(void *in, void *out, void *arg);
+
+// estrutura que define um estágio de um pipeline
+typedef struct stage_t
+{
+    const char *name;             // nome do estágio (opcional)
+    stage_func_t func;            // corpo do estágio
+    void *arg;                    // argumento do corpo
+    int item_size;                // tamanho dos itens de saída; 0 sem saída
+    int in_size;                  // tamanho dos itens de entrada; 0 se fonte
+    int parallelism;              // número de workers
+    int capacity;                 // capacidade da fila de entrada, em itens
+    struct stage_t *next;         // estágio que recebe a saída; NULL se nenhum
+    int inputs;                   // estágios de entrada ainda em execução
+    int running;                  // workers em execução
+    int lock;                     // protege inputs e running
+    mqueue_t queue;               // fila de entrada, em lotes
+    task_t **workers;             // tarefas do estágio
+    unsigned long items_in;       // itens recebidos
+    unsigned long items_out;      // itens produzidos
+    unsigned long batches;        // lotes recebidos na fila de entrada
+    int max_depth;                // maior ocupação da fila de entrada (lotes)
+    unsigned long long depth_sum; // soma das ocupações a cada lote recebido
+    unsigned int busy;            // processamento dos workers (ms)
+    unsigned int send_wait;       // espera por espaço na fila seguinte (ms)
+    unsigned int recv_wait;       // espera por lotes na fila de entrada (ms)
+    unsigned int end;             // término do último worker
+} stage_t;
+
+// estrutura que define um pipeline: estágios ligados por filas de mensagens
+typedef struct
+{
+    stage_t stages[PIPELINE_STAGES]; // estágios declarados
+    int count;                       // número de estágios
+    int active;                      // flag de ativação
+    int running;                     // já iniciado por pipeline_run
+    unsigned int start;              // instante de pipeline_run
+} pipeline_t;
+
 #endif
@@ -0,0 +1,114 @@
+// Micro-tarefas: chamadas curtas fn(arg), que nunca bloqueiam, executadas
+// pelo dispatcher na sua própria pilha, entre duas escolhas do escalonador.
+// Não têm descritor, pilha nem contexto: ppos_defer insere o par em um anel
+// da cpu corrente, sem travas, e o dispatcher o esvazia, no máximo
+// defer_budget micro-tarefas por vez, para que as tarefas prontas não
+// esperem. Uma tarefa que libera o processador com micro-tarefas pendentes
+// passa pelo dispatcher (reschedule). Uma micro-tarefa pode criar outras e
+// acordar tarefas; as operações bloqueantes que ela chamar retornam -1 sem
+// bloquear.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ppos.h"
+
+// micro-tarefa pendente
+typedef struct
+{
+    void (*fn)(void *); // função a executar
+    void *arg;          // argumento de fn
+} micro_t;
+
+extern __thread int kernel_lock;
+
+__thread int deferred = 0;        // micro-tarefas pendentes nesta cpu
+__thread int deferring = 0;       // uma micro-tarefa executa nesta cpu
+int defer_budget = DEFER_BUDGET;  // micro-tarefas entre duas escolhas
+
+// anel de micro-tarefas de cada cpu; a capacidade é uma potência de 2 e os
+// índices crescem livremente, reduzidos por uma máscara
+static __thread micro_t *ring = NULL;
+static __thread unsigned int ring_size = 0;
+static __thread unsigned int head = 0, tail = 0;
+
+static unsigned long calls = 0;  // micro-tarefas executadas
+static unsigned long passes = 0; // esvaziamentos do anel pelo dispatcher
+static int max_pending = 0;      // maior número de micro-tarefas pendentes
+
+// dobra a capacidade do anel, mantendo as micro-tarefas pendentes em ordem
+static int ring_grow(void) {
+    unsigned int size = ring_size > 0 ? ring_size * 2 : 256;
+    micro_t *new_ring = malloc(size * sizeof(micro_t));
+
+    if (new_ring == NULL) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < (unsigned int)deferred; i++) {
+        new_ring[i] = ring[(head + i) & (ring_size - 1)];
+    }
+
+    free(ring);
+    ring = new_ring;
+    ring_size = size;
+    head = 0;
+    tail = deferred;
+
+    return 0;
+}
+
+int ppos_defer(void (*fn)(void *), void *arg) {
+    if (fn == NULL) {
+        return -1;
+    }
+
+    // sem preempção, a tarefa não muda de cpu no meio da inserção
+    kernel_lock++;
+
+    if ((unsigned int)deferred == ring_size && ring_grow() < 0) {
+        kernel_lock--;
+        return -1;
+    }
+
+    micro_t *m = &ring[tail++ & (ring_size - 1)];
+
+    m->fn = fn;
+    m->arg = arg;
+
+    if (++deferred > max_pending) {
+        max_pending = deferred;
+    }
+
+    kernel_lock--;
+
+    return 0;
+}
+
+// executa até defer_budget micro-tarefas da cpu; chamada pelo dispatcher. O
+// anel pode crescer durante a chamada de uma micro-tarefa, por isso cada uma
+// é copiada antes de executada.
+void defer_run(void) {
+    int n;
+
+    for (n = 0; n < defer_budget && deferred > 0; n++) {
+        micro_t m = ring[head++ & (ring_size - 1)];
+
+        deferred--;
+        deferring = 1;
+        m.fn(m.arg);
+        deferring = 0;
+    }
+
+    __sync_fetch_and_add(&calls, n);
+    __sync_fetch_and_add(&passes, 1);
+}
+
+void defer_print(void) {
+    if (calls == 0) {
+        return;
+    }
+
+    printf("Micro-tasks: %lu calls, %lu passes (avg %lu), max %d pending\n", calls, passes,
+           calls / passes, max_pending);
+}
@@ -0,0 +1,277 @@
+// Futuros: um valor definido uma única vez, pela tarefa criada por
+// task_async ou diretamente por future_set (promessa), e aguardado com
+// future_get. As tarefas que aguardam o valor ficam suspensas na fila do
+// futuro, como em task_join, e são acordadas por quem o define. As
+// continuações de future_then executam na tarefa que define o valor, sem
+// criar outra tarefa.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppos.h"
+
+extern __thread task_t *current_task;
+extern __thread task_t *cpu_dispatcher;
+
+extern void ready_append(task_t *task);
+extern void reschedule(void);
+extern void enter_cs(int *lock);
+extern void leave_cs(int *lock);
+
+static void future_init(future_t *f, int allocated) {
+    memset(f, 0, sizeof(future_t));
+    f->state = FUTURE_PENDING;
+    f->allocated = allocated;
+    f->active = 1;
+}
+
+// futuro alocado pelo núcleo, liberado por future_destroy
+static future_t *future_alloc(void) {
+    future_t *f = malloc(sizeof(future_t));
+
+    if (f != NULL) {
+        future_init(f, 1);
+    }
+
+    return f;
+}
+
+// acorda todas as tarefas de uma fila de espera já retirada do futuro
+static void wake_all(task_t *queue) {
+    while (queue != NULL) {
+        task_t *task = queue;
+
+        queue_remove((queue_t **)&queue, (queue_t *)task);
+        ready_append(task);
+    }
+}
+
+// define o valor do futuro (ou copia size bytes de data para dentro dele),
+// executa as continuações e acorda as tarefas que o aguardam; depois disso o
+// futuro não é mais acessado aqui. Uma tarefa acordada pode destruí-lo
+// enquanto as demais ainda não retomaram: cada uma copia o valor sob a
+// trava, e o futuro destruído só é liberado pela última delas.
+static int future_complete(future_t *f, void *value, const void *data, int size) {
+    if (f == NULL || f->active == 0 || size < 0 || size > FUTURE_BLOB) {
+        return -1;
+    }
+
+    enter_cs(&f->lock);
+    if (f->state != FUTURE_PENDING) {
+        leave_cs(&f->lock);
+        return -1;
+    }
+
+    if (data != NULL) {
+        memcpy(f->blob, data, size);
+        value = f->blob;
+    }
+
+    f->value = value;
+    f->state = FUTURE_SETTING;
+
+    future_cont_t *c = f->conts;
+
+    f->conts = NULL;
+    leave_cs(&f->lock);
+
+    // as continuações foram empilhadas: inverte a lista para executá-las na
+    // ordem em que foram registradas
+    future_cont_t *list = NULL;
+
+    while (c != NULL) {
+        future_cont_t *next = c->next;
+
+        c->next = list;
+        list = c;
+        c = next;
+    }
+
+    while (list != NULL) {
+        c = list;
+        list = c->next;
+
+        future_set(c->result, c->func(value, c->arg));
+        free(c);
+    }
+
+    enter_cs(&f->lock);
+    f->state = FUTURE_READY;
+    task_t *queue = f->task_queue;
+    f->task_queue = NULL;
+    leave_cs(&f->lock);
+
+    wake_all(queue);
+
+    return 0;
+}
+
+int future_create(future_t *f) {
+    if (f == NULL || f->active) {
+        return -1;
+    }
+
+    future_init(f, 0);
+
+    return 0;
+}
+
+int future_set(future_t *f, void *value) {
+    return future_complete(f, value, NULL, 0);
+}
+
+int future_set_blob(future_t *f, const void *data, int size) {
+    if (data == NULL) {
+        return -1;
+    }
+
+    return future_complete(f, NULL, data, size);
+}
+
+void *future_get(future_t *f) {
+    if (f == NULL || f->active == 0 || current_task == cpu_dispatcher) {
+        return NULL;
+    }
+
+    int release = 0;
+
+    // a verificação do estado e a entrada na fila ocorrem sob a mesma trava
+    // em que o valor é publicado, para que nenhuma tarefa espere para sempre
+    enter_cs(&f->lock);
+    if (f->state != FUTURE_READY) {
+        current_task->status = SUSPENDED;
+        queue_append((queue_t **)&(f->task_queue), (queue_t *)current_task);
+        f->waiters++;
+        leave_cs(&f->lock);
+
+        reschedule();
+
+        // a última tarefa acordada libera o futuro alocado que outra destruiu
+        enter_cs(&f->lock);
+        release = --f->waiters == 0 && f->active == 0 && f->allocated;
+    }
+
+    // caso o futuro tenha sido destruído
+    void *value = f->active ? f->value : NULL;
+    leave_cs(&f->lock);
+
+    if (release) {
+        free(f);
+    }
+
+    return value;
+}
+
+int future_ready(future_t *f) {
+    if (f == NULL || f->active == 0) {
+        return -1;
+    }
+
+    return f->state == FUTURE_READY;
+}
+
+future_t *future_then(future_t *f, void *(*func)(void *value, void *arg), void *arg) {
+    if (f == NULL || f->active == 0 || func == NULL) {
+        return NULL;
+    }
+
+    future_t *result = future_alloc();
+    future_cont_t *c = malloc(sizeof(future_cont_t));
+
+    if (result == NULL || c == NULL) {
+        free(result);
+        free(c);
+        return NULL;
+    }
+
+    c->func = func;
+    c->arg = arg;
+    c->result = result;
+
+    // sem o valor, a continuação fica para quem o definir
+    enter_cs(&f->lock);
+    if (f->state == FUTURE_PENDING) {
+        c->next = f->conts;
+        f->conts = c;
+        leave_cs(&f->lock);
+
+        return result;
+    }
+    leave_cs(&f->lock);
+
+    // o valor já está definido: a continuação executa agora
+    free(c);
+    future_set(result, func(f->value, arg));
+
+    return result;
+}
+
+int future_destroy(future_t *f) {
+    if (f == NULL || f->active == 0) {
+        return -1;
+    }
+
+    enter_cs(&f->lock);
+    f->active = 0;
+    task_t *queue = f->task_queue;
+    future_cont_t *c = f->conts;
+
+    f->task_queue = NULL;
+    f->conts = NULL;
+
+    // com tarefas ainda por retomar, a última delas libera o futuro
+    int release = f->allocated && f->waiters == 0;
+    leave_cs(&f->lock);
+
+    // as continuações nunca executadas não definem os seus futuros
+    while (c != NULL) {
+        future_cont_t *next = c->next;
+
+        free(c);
+        c = next;
+    }
+
+    wake_all(queue);
+
+    if (release) {
+        free(f);
+    }
+
+    return 0;
+}
+
+// corpo das tarefas de task_async
+static void async_body(void *arg) {
+    future_t *f = arg;
+
+    future_set(f, f->func(f->arg));
+    task_exit(0);
+}
+
+future_t *task_async(void *(*func)(void *), void *arg) {
+    if (func == NULL) {
+        return NULL;
+    }
+
+    future_t *f = future_alloc();
+
+    if (f == NULL) {
+        return NULL;
+    }
+
+    f->func = func;
+    f->arg = arg;
+
+    // o resultado é entregue pelo futuro: ninguém aguarda a tarefa, cujo
+    // descritor é reciclado assim que ela termina
+    task_t *task = task_spawn(async_body, f);
+
+    if (task == NULL) {
+        free(f);
+        return NULL;
+    }
+
+    task_detach(task);
+
+    return f;
+}
@@ -0,0 +1,105 @@
+// Geradores: uma tarefa que produz valores sob demanda. A tarefa
+// consumidora, em task_next, entrega o processador diretamente à tarefa do
+// gerador, que executa até produzir um valor com task_yield_value e então
+// devolve o processador diretamente à consumidora. O valor é um ponteiro
+// passado sem cópia, e nenhuma das trocas passa pelo escalonador ou por
+// semáforos: fora delas, a tarefa que aguarda fica suspensa, fora da fila de
+// prontas. Ambas continuam sujeitas à preempção, e o gerador preemptado
+// volta pela fila de prontas como qualquer tarefa.
+
+#include "ppos.h"
+
+extern __thread task_t *current_task;
+extern __thread task_t *cpu_dispatcher;
+
+extern void ready_append(task_t *task);
+extern int task_handoff(task_t *task);
+extern int task_create_suspended(task_t *task, void (*start_func)(void *), void *arg);
+extern void task_background(task_t *task);
+
+// corpo das tarefas dos geradores
+static void generator_body(void *arg) {
+    generator_t *gen = arg;
+
+    gen->func(gen->arg);
+
+    // a consumidora recebe NULL; ela volta pela fila de prontas, pois esta
+    // tarefa ainda precisa encerrar
+    gen->value = NULL;
+    gen->done = 1;
+    ready_append(gen->consumer);
+
+    task_exit(0);
+}
+
+int task_generator_create(generator_t *gen, void (*func)(void *), void *arg) {
+    if (gen == NULL || func == NULL) {
+        return -1;
+    }
+
+    gen->done = 0;
+    gen->cancel = 0;
+    gen->consumer = NULL;
+    gen->value = NULL;
+    gen->func = func;
+    gen->arg = arg;
+
+    // a tarefa só executa quando a consumidora lhe entrega o processador
+    if (task_create_suspended(&gen->task, generator_body, gen) < 0) {
+        return -1;
+    }
+
+    // o corpo só executa no lugar de uma consumidora, que já conta como
+    // tarefa do usuário; um gerador abandonado não impede o encerramento
+    task_background(&gen->task);
+
+    gen->active = 1;
+
+    return 0;
+}
+
+int task_yield_value(void *value) {
+    // apenas o corpo de um gerador produz valores
+    if (current_task->start_func != generator_body || value == NULL) {
+        return -1;
+    }
+
+    generator_t *gen = current_task->arg;
+
+    if (gen->cancel) {
+        return -1;
+    }
+
+    gen->value = value;
+    task_handoff(gen->consumer);
+
+    return gen->cancel ? -1 : 0;
+}
+
+void *task_next(generator_t *gen) {
+    if (gen == NULL || gen->active == 0 || gen->done || current_task == cpu_dispatcher) {
+        return NULL;
+    }
+
+    gen->consumer = current_task;
+    task_handoff(&gen->task);
+
+    return gen->value;
+}
+
+int task_generator_destroy(generator_t *gen) {
+    if (gen == NULL || gen->active == 0 || current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    // o corpo é retomado até terminar, com task_yield_value retornando -1
+    gen->cancel = 1;
+    while (!gen->done) {
+        gen->consumer = current_task;
+        task_handoff(&gen->task);
+    }
+
+    gen->active = 0;
+
+    return task_join(&gen->task) < 0 ? -1 : 0;
+}
@@ -3,20 +3,15 @@
 
 #include "ppos.h"
 
-extern task_t *current_task;
-extern task_t *ready_queue;
-extern task_t dispatcher_task;
+extern __thread task_t *current_task;
+extern __thread task_t *cpu_dispatcher;
 
-static int lock = 0;
-
-static void enter_cs(int *lock) {
-    while (__sync_fetch_and_or(lock, 1))
-        ;
-}
+extern void ready_append(task_t *task);
+extern void reschedule(void);
+extern void enter_cs(int *lock);
+extern void leave_cs(int *lock);
 
-static void leave_cs(int *lock) {
-    (*lock) = 0;
-}
+static int lock = 0;
 
 int sem_create(semaphore_t *s, int value) {
     if (s == NULL || s->active) {
@@ -32,23 +27,23 @@ int sem_create(semaphore_t *s, int value) {
 }
 
 int sem_down(semaphore_t *s) {
-    if (s == NULL || s->active == 0) {
+    // uma micro-tarefa executa no dispatcher e não pode bloquear
+    if (s == NULL || s->active == 0 || current_task == cpu_dispatcher) {
         return -1;
     }
 
     enter_cs(&lock);
     s->counter--;
-    leave_cs(&lock);
 
     // contador negativo: chamada bloqueante
     if (s->counter < 0) {
         current_task->status = SUSPENDED;
-
-        enter_cs(&lock);
         queue_append((queue_t **)&(s->task_queue), (queue_t *)current_task);
         leave_cs(&lock);
 
-        task_switch(&dispatcher_task);
+        reschedule();
+    } else {
+        leave_cs(&lock);
     }
 
     // caso semáforo tenha sido destruído
@@ -59,25 +54,46 @@ int sem_down(semaphore_t *s) {
     return 0;
 }
 
+// decrementa o semáforo e, se preciso, coloca waiter na sua fila, sem trocar
+// de contexto; retorna 1 se a tarefa foi suspensa e 0 se não. Usada pelas
+// corrotinas.
+int sem_down_async(semaphore_t *s, task_t *waiter) {
+    if (s == NULL || s->active == 0) {
+        return -1;
+    }
+
+    int wait;
+
+    enter_cs(&lock);
+    if ((wait = --s->counter < 0)) {
+        waiter->status = SUSPENDED;
+        queue_append((queue_t **)&(s->task_queue), (queue_t *)waiter);
+    }
+    leave_cs(&lock);
+
+    return wait;
+}
+
 int sem_up(semaphore_t *s) {
     if (s == NULL || s->active == 0) {
         return -1;
     }
 
+    task_t *task = NULL;
+
     enter_cs(&lock);
     s->counter++;
-    leave_cs(&lock);
 
     // caso haja tarefas aguardando na fila do semáforo
-    if (s->counter <= 0) {
-        enter_cs(&lock);
-        task_t *task = (task_t *)s->task_queue;
-        queue_remove((queue_t **)&(s->task_queue), (queue_t *)(s->task_queue));
-        leave_cs(&lock);
+    if (s->counter <= 0 && s->task_queue != NULL) {
+        task = s->task_queue;
+        queue_remove((queue_t **)&(s->task_queue), (queue_t *)task);
+    }
+    leave_cs(&lock);
 
-        // acorda a primeira tarefa da fila e retorna à fila de prontas
-        task->status = READY;
-        queue_append((queue_t **)&ready_queue, (queue_t *)task);
+    // acorda a primeira tarefa da fila e retorna à fila de prontas
+    if (task != NULL) {
+        ready_append(task);
     }
 
     return 0;
@@ -123,16 +139,11 @@ int mqueue_create(mqueue_t *queue, int max, int size) {
     return 0;
 }
 
-int mqueue_send(mqueue_t *queue, void *msg) {
-    if (queue == NULL || queue->active == 0) {
-        return -1;
-    }
-
+// copia a mensagem para o fim da fila; quem chama já obteve uma posição livre
+// (s_space) e o acesso ao buffer (s_buffer)
+void mqueue_put(mqueue_t *queue, void *msg) {
     int size = queue->item_size;
 
-    sem_down(&queue->s_space);
-    sem_down(&queue->s_buffer);
-
     // copia a mensagem para o fim da fila
     void *dest = queue->buffer + queue->buf_end * size;
     memcpy(dest, msg, size);
@@ -140,6 +151,31 @@ int mqueue_send(mqueue_t *queue, void *msg) {
     // atualiza o tamanho e o final da fila
     queue->buf_end = (queue->buf_end + 1) % queue->capacity;
     queue->length++;
+}
+
+// retira a mensagem do início da fila; quem chama já obteve uma mensagem
+// (s_item) e o acesso ao buffer (s_buffer)
+void mqueue_take(mqueue_t *queue, void *msg) {
+    int size = queue->item_size;
+
+    // recebe a mensagem do início da fila e a deposita no buffer msg
+    void *src = queue->buffer + size * queue->buf_start;
+    memcpy(msg, src, size);
+
+    // atualiza o tamanho e o início da fila
+    queue->buf_start = (queue->buf_start + 1) % queue->capacity;
+    queue->length--;
+}
+
+int mqueue_send(mqueue_t *queue, void *msg) {
+    if (queue == NULL || queue->active == 0 || current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    sem_down(&queue->s_space);
+    sem_down(&queue->s_buffer);
+
+    mqueue_put(queue, msg);
 
     sem_up(&queue->s_buffer);
     sem_up(&queue->s_item);
@@ -148,22 +184,14 @@ int mqueue_send(mqueue_t *queue, void *msg) {
 }
 
 int mqueue_recv(mqueue_t *queue, void *msg) {
-    if (queue == NULL || queue->active == 0) {
+    if (queue == NULL || queue->active == 0 || current_task == cpu_dispatcher) {
         return -1;
     }
 
-    int size = queue->item_size;
-
     sem_down(&queue->s_item);
     sem_down(&queue->s_buffer);
 
-    // recebe a mensagem do início da fila e a deposita no buffer msg
-    void *src = queue->buffer + size * queue->buf_start;
-    memcpy(msg, src, size);
-
-    // atualiza o tamanho e o início da fila
-    queue->buf_start = (queue->buf_start + 1) % queue->capacity;
-    queue->length--;
+    mqueue_take(queue, msg);
 
     sem_up(&queue->s_buffer);
     sem_up(&queue->s_space);
@@ -194,3 +222,158 @@ int mqueue_msgs(mqueue_t *queue) {
 
     return queue->length;
 }
+
+int xqueue_create(xqueue_t *queue, int max, int size) {
+    if (queue == NULL || queue->active || max <= 0) {
+        return -1;
+    }
+
+    // a capacidade é arredondada para uma potência de 2, de forma que os
+    // índices possam crescer livremente e ser reduzidos por uma máscara
+    int capacity = 1;
+
+    while (capacity < max) {
+        capacity <<= 1;
+    }
+
+    if ((queue->buffer = malloc(capacity * size)) == NULL) {
+        return -1;
+    }
+
+    // inicializa os campos da fila de mensagens
+    queue->capacity = capacity;
+    queue->item_size = size;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->lock = 0;
+    queue->sender = NULL;
+    queue->receiver = NULL;
+    queue->active = 1;
+
+    return 0;
+}
+
+// suspende a tarefa corrente em *waiter enquanto o índice do outro lado
+// valer value; retorna 0, ou -1 se a fila foi destruída. A tarefa se
+// registra antes de verificar o índice de novo, e o outro lado avança o
+// índice antes de procurar quem aguarda, de forma que um dos dois sempre vê
+// o outro.
+static int xqueue_wait(xqueue_t *queue, task_t **waiter, unsigned int *index, unsigned int value) {
+    while (__atomic_load_n(index, __ATOMIC_ACQUIRE) == value) {
+        enter_cs(&queue->lock);
+        if (queue->active == 0) {
+            leave_cs(&queue->lock);
+            return -1;
+        }
+
+        __atomic_store_n(waiter, current_task, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(index, __ATOMIC_SEQ_CST) != value) {
+            *waiter = NULL;
+            leave_cs(&queue->lock);
+            break;
+        }
+
+        current_task->status = SUSPENDED;
+        leave_cs(&queue->lock);
+
+        reschedule();
+    }
+
+    return queue->active ? 0 : -1;
+}
+
+// acorda a tarefa do outro lado, se estiver suspensa em *waiter; ela volta à
+// fila de prontas da sua cpu
+static void xqueue_wake(xqueue_t *queue, task_t **waiter) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiter, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+
+    enter_cs(&queue->lock);
+    task_t *task = *waiter;
+    *waiter = NULL;
+    leave_cs(&queue->lock);
+
+    if (task != NULL) {
+        ready_append(task);
+    }
+}
+
+int xqueue_send(xqueue_t *queue, void *msg) {
+    if (queue == NULL || queue->active == 0 || current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    unsigned int tail = queue->tail;
+
+    // fila cheia: aguarda o consumidor, que está em outra cpu
+    if (xqueue_wait(queue, &queue->sender, &queue->head, tail - queue->capacity) < 0) {
+        return -1;
+    }
+
+    // copia a mensagem para o fim da fila e só então a publica
+    void *dest = queue->buffer + (tail & (queue->capacity - 1)) * queue->item_size;
+    memcpy(dest, msg, queue->item_size);
+
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    xqueue_wake(queue, &queue->receiver);
+
+    return 0;
+}
+
+int xqueue_recv(xqueue_t *queue, void *msg) {
+    if (queue == NULL || queue->active == 0 || current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    unsigned int head = queue->head;
+
+    // fila vazia: aguarda o produtor, que está em outra cpu
+    if (xqueue_wait(queue, &queue->receiver, &queue->tail, head) < 0) {
+        return -1;
+    }
+
+    // copia a mensagem do início da fila e só então libera a posição
+    void *src = queue->buffer + (head & (queue->capacity - 1)) * queue->item_size;
+    memcpy(msg, src, queue->item_size);
+
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    xqueue_wake(queue, &queue->sender);
+
+    return 0;
+}
+
+int xqueue_destroy(xqueue_t *queue) {
+    if (queue == NULL || queue->active == 0) {
+        return -1;
+    }
+
+    // as tarefas suspensas acordam e encontram a fila destruída
+    enter_cs(&queue->lock);
+    queue->active = 0;
+    task_t *sender = queue->sender, *receiver = queue->receiver;
+    queue->sender = queue->receiver = NULL;
+    leave_cs(&queue->lock);
+
+    if (sender != NULL) {
+        ready_append(sender);
+    }
+
+    if (receiver != NULL) {
+        ready_append(receiver);
+    }
+
+    free(queue->buffer);
+
+    return 0;
+}
+
+int xqueue_msgs(xqueue_t *queue) {
+    if (queue == NULL || queue->active == 0) {
+        return -1;
+    }
+
+    return __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+}
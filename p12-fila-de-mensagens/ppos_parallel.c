@@ -0,0 +1,276 @@
+// Laços paralelos: o intervalo do laço é dividido em partes de grain
+// iterações. A tarefa que chama task_parallel_for entrega metade das partes
+// a um worker, metade do que restou a outro, e assim por diante, até ficar
+// com uma única parte; cada worker divide do mesmo modo as partes que
+// recebeu. Os workers formam um pool mantido pelo núcleo, criado na
+// primeira chamada, com uma tarefa por cpu além da que chama o laço, e os
+// trabalhos executam com a prioridade dela. A última parte concluída acorda
+// a tarefa que chamou o laço, que portanto bloqueia no máximo uma vez.
+//
+// Com uma única cpu não há workers: as partes executam em sequência na
+// própria tarefa, sem trocas de contexto.
+//
+// Tamanho das partes: quando não é indicado, o núcleo mede o tempo de
+// processamento (proc_time) gasto nas partes de cada chamada e guarda, para
+// cada função de laço, quantas iterações ela executa por ms; a chamada
+// seguinte usa partes de cerca de PARALLEL_GRAIN ms. Sem medida anterior, o
+// intervalo é dividido em PARALLEL_SPLIT partes por cpu.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ppos.h"
+
+#define PARALLEL_SITES 16 // funções de laço com a medida guardada
+#define PARALLEL_SPLIT 8  // partes por cpu sem medida anterior
+
+// medida de uma função de laço
+typedef struct
+{
+    void *fn;  // função de laço
+    long rate; // iterações por ms de processamento
+} site_t;
+
+struct parallel_t;
+
+// partes [first, last) entregues a um worker; first é a posição da divisão
+// no vetor de divisões do laço
+typedef struct
+{
+    struct parallel_t *par; // laço
+    long last;              // fim das partes entregues
+} split_t;
+
+// um laço em execução
+typedef struct parallel_t
+{
+    long begin, end, grain;                // intervalo e tamanho das partes
+    void (*each)(long, long, void *);      // corpo de task_parallel_for
+    long (*fn)(long, long, void *);        // corpo de task_parallel_reduce
+    long (*combine)(long, long);           // combinação dos valores parciais
+    void *ctx;                             // argumento do corpo
+    long *result;                          // valor combinado
+    int lock;                              // protege result
+    int prio;                              // prioridade dos trabalhos
+    long left;                             // partes por concluir
+    unsigned int ms;                       // processamento gasto nas partes
+    semaphore_t done;                      // liberado pela última parte
+    split_t *splits;                       // divisões; NULL sem workers
+} parallel_t;
+
+static task_pool_t pool;                   // workers dos laços paralelos
+static int workers = -1;                   // workers no pool; -1 se não criado
+static int pool_lock = 0;                  // protege a criação do pool
+static site_t sites[PARALLEL_SITES];       // medidas das funções de laço
+static int sites_lock = 0;                 // protege sites
+static unsigned int calls = 0;             // laços executados
+static unsigned long parts = 0;            // partes executadas
+
+extern __thread task_t *current_task;
+extern __thread task_t *cpu_dispatcher;
+extern int smp_cpus;
+
+extern void enter_cs(int *lock);
+extern void leave_cs(int *lock);
+extern unsigned int task_proctime(void);
+extern void task_background(task_t *task);
+
+// cria os workers na primeira chamada; eles não impedem o encerramento do
+// sistema, pois ficam bloqueados à espera de trabalhos
+static void workers_init(void) {
+    enter_cs(&pool_lock);
+    if (workers < 0) {
+        workers = 0;
+
+        if (smp_cpus > 1 && task_pool_create(&pool, smp_cpus - 1) == 0) {
+            for (int i = 0; i < pool.size; i++) {
+                task_background(pool.workers[i]);
+            }
+            workers = pool.size;
+        }
+    }
+    leave_cs(&pool_lock);
+}
+
+static site_t *site(void *fn) {
+    return &sites[((uintptr_t)fn >> 4) % PARALLEL_SITES];
+}
+
+// tamanho das partes para n iterações de fn, pela medida anterior
+static long auto_grain(void *fn, long n) {
+    long rate = 0;
+
+    enter_cs(&sites_lock);
+    if (site(fn)->fn == fn) {
+        rate = site(fn)->rate;
+    }
+    leave_cs(&sites_lock);
+
+    if (rate > 0) {
+        return rate * PARALLEL_GRAIN;
+    }
+
+    return n / (PARALLEL_SPLIT * (workers + 1));
+}
+
+// registra a medida de uma chamada: n iterações em ms de processamento
+static void site_update(void *fn, long n, unsigned int ms) {
+    // partes rápidas demais para o relógio: a taxa é de ao menos n por ms
+    long rate = n / (ms > 0 ? ms : 1);
+
+    enter_cs(&sites_lock);
+    site_t *s = site(fn);
+
+    if (s->fn != fn) {
+        s->fn = fn;
+        s->rate = rate;
+    } else if (ms > 0) {
+        s->rate = (s->rate + rate) / 2;
+    } else if (rate > s->rate) {
+        s->rate = rate;
+    }
+    leave_cs(&sites_lock);
+}
+
+// executa a parte i do laço
+static void run_part(parallel_t *par, long i) {
+    long b = par->begin + i * par->grain;
+    long e = par->end - b > par->grain ? b + par->grain : par->end;
+    unsigned int start = task_proctime();
+
+    if (par->fn != NULL) {
+        long value = par->fn(b, e, par->ctx);
+
+        enter_cs(&par->lock);
+        *par->result = par->combine(*par->result, value);
+        leave_cs(&par->lock);
+    } else {
+        par->each(b, e, par->ctx);
+    }
+
+    __sync_fetch_and_add(&par->ms, task_proctime() - start);
+
+    // a tarefa que chamou o laço pode retornar assim que a última parte
+    // termina: par não é mais acessado depois disso
+    if (par->splits != NULL && __sync_sub_and_fetch(&par->left, 1) == 0) {
+        sem_up(&par->done);
+    }
+}
+
+static void run_split(void *arg);
+
+// divide as partes [first, last) com os workers e executa a primeira
+static void run_parts(parallel_t *par, long first, long last) {
+    while (last - first > 1) {
+        long mid = first + (last - first) / 2;
+        split_t *split = &par->splits[mid];
+
+        split->par = par;
+        split->last = last;
+
+        // se o trabalho não puder ser submetido, a tarefa executa as partes
+        if (task_pool_submit(&pool, run_split, split, par->prio) < 0) {
+            run_parts(par, mid, last);
+        }
+
+        last = mid;
+    }
+
+    run_part(par, first);
+}
+
+// trabalho dos workers: uma divisão do laço
+static void run_split(void *arg) {
+    split_t *split = arg;
+
+    run_parts(split->par, split - split->par->splits, split->last);
+}
+
+// executa o laço descrito por par e registra a medida da sua função
+static int run(parallel_t *par, void *fn) {
+    long n = par->end - par->begin;
+
+    // uma micro-tarefa não pode esperar pelos workers
+    if (current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    workers_init();
+
+    if (par->grain <= 0 && (par->grain = auto_grain(fn, n)) <= 0) {
+        par->grain = 1;
+    }
+
+    long count = (n + par->grain - 1) / par->grain;
+
+    // sem workers, as partes executam em sequência na tarefa corrente
+    if (workers == 0 || count == 1) {
+        for (long i = 0; i < count; i++) {
+            run_part(par, i);
+        }
+    } else {
+        if ((par->splits = malloc(count * sizeof(split_t))) == NULL) {
+            return -1;
+        }
+
+        par->left = count;
+        par->prio = task_getprio(NULL);
+        sem_create(&par->done, 0);
+
+        run_parts(par, 0, count);
+
+        sem_down(&par->done);
+        sem_destroy(&par->done);
+        free(par->splits);
+    }
+
+    site_update(fn, n, par->ms);
+    __sync_fetch_and_add(&calls, 1);
+    __sync_fetch_and_add(&parts, count);
+
+    return 0;
+}
+
+int task_parallel_for(long begin, long end, long grain,
+                      void (*fn)(long begin, long end, void *ctx), void *ctx) {
+    if (fn == NULL || end < begin) {
+        return -1;
+    }
+
+    if (begin == end) {
+        return 0;
+    }
+
+    parallel_t par = {.begin = begin, .end = end, .grain = grain, .each = fn, .ctx = ctx};
+
+    return run(&par, fn);
+}
+
+int task_parallel_reduce(long begin, long end, long grain,
+                         long (*fn)(long begin, long end, void *ctx),
+                         long (*combine)(long a, long b), void *ctx, long *result) {
+    if (fn == NULL || combine == NULL || result == NULL || end < begin) {
+        return -1;
+    }
+
+    if (begin == end) {
+        return 0;
+    }
+
+    parallel_t par = {.begin = begin, .end = end, .grain = grain, .fn = fn,
+                      .combine = combine, .ctx = ctx, .result = result};
+
+    return run(&par, fn);
+}
+
+// imprime as estatísticas dos laços no encerramento do sistema com
+// PPOS_STATS=1, se houve algum
+void parallel_print(void) {
+    if (calls == 0) {
+        return;
+    }
+
+    printf("Parallel loops: %u calls, %lu parts (avg %lu), %d workers\n", calls, parts,
+           parts / calls, workers);
+}
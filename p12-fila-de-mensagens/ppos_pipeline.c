@@ -0,0 +1,325 @@
+// Pipelines: estágios declarados com pipeline_stage, cada um executado por
+// parallelism workers (tarefas de task_spawn) e ligados por filas de
+// mensagens com pipeline_connect. Um estágio tem uma única saída, mas pode
+// receber de vários estágios, cujos itens chegam pela mesma fila.
+//
+// Os itens não passam um a um pelas filas: cada worker acumula os seus itens
+// de saída em um lote de até PIPELINE_BATCH itens, enviado como uma única
+// mensagem quando fica cheio ou quando o worker não tem mais lotes a
+// receber, para que um fluxo lento não fique retido. As filas têm
+// capacidade limitada, e um estágio mais rápido que o seguinte bloqueia no
+// envio (contrapressão): a espera aparece nas estatísticas de cada estágio,
+// junto com a ocupação da sua fila de entrada, e o estágio com mais
+// processamento por worker é apontado como o gargalo.
+//
+// Encerramento: quando o último worker de um estágio termina, ele avisa o
+// estágio seguinte; quando todos os estágios de entrada de um estágio
+// terminaram, um lote de fim é enviado para cada um dos seus workers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppos.h"
+
+// lote de itens transferido entre estágios; count < 0 encerra o worker que o
+// recebe
+typedef struct
+{
+    int count;                                 // itens no lote
+    char items[] __attribute__((aligned(16))); // itens, em sequência
+} batch_t;
+
+extern __thread task_t *current_task;
+extern __thread task_t *cpu_dispatcher;
+extern int print_stats;
+
+extern void enter_cs(int *lock);
+extern void leave_cs(int *lock);
+extern unsigned int task_proctime(void);
+
+// tamanho de um lote de itens de size bytes
+static int batch_size(int size) {
+    return sizeof(batch_t) + PIPELINE_BATCH * size;
+}
+
+// envia o lote do estágio à fila do estágio seguinte e o esvazia
+static void batch_send(stage_t *st, batch_t *out) {
+    stage_t *next = st->next;
+    unsigned int start = systime();
+
+    mqueue_send(&next->queue, out);
+
+    unsigned int wait = systime() - start;
+    int depth = mqueue_msgs(&next->queue);
+
+    __sync_fetch_and_add(&st->send_wait, wait);
+
+    enter_cs(&next->lock);
+    next->batches++;
+    next->depth_sum += depth;
+    if (depth > next->max_depth) {
+        next->max_depth = depth;
+    }
+    leave_cs(&next->lock);
+
+    out->count = 0;
+}
+
+// um estágio de entrada de next terminou; com o último, os workers de next
+// recebem o lote de fim, enviado no buffer de lotes end
+static void stage_close(stage_t *next, batch_t *end) {
+    enter_cs(&next->lock);
+    int last = --next->inputs == 0;
+    leave_cs(&next->lock);
+
+    if (!last) {
+        return;
+    }
+
+    end->count = -1;
+    for (int i = 0; i < next->parallelism; i++) {
+        mqueue_send(&next->queue, end);
+    }
+}
+
+// acrescenta ao lote o item recém-produzido, enviando o lote se ficou cheio
+static void batch_push(stage_t *st, batch_t *out) {
+    if (++out->count == PIPELINE_BATCH) {
+        batch_send(st, out);
+    }
+}
+
+// corpo dos workers dos estágios
+static void stage_worker(void *arg) {
+    stage_t *st = arg;
+    batch_t *in = NULL, *out = NULL;
+    unsigned long items_in = 0, items_out = 0;
+    unsigned int recv_wait = 0;
+
+    if ((st->in_size > 0 && (in = malloc(batch_size(st->in_size))) == NULL) ||
+        (st->next != NULL && (out = malloc(batch_size(st->item_size))) == NULL)) {
+        perror("Erro ao criar os lotes do pipeline");
+        exit(1);
+    }
+
+    if (out != NULL) {
+        out->count = 0;
+    }
+
+    for (;;) {
+        // fonte: produz itens até o corpo indicar o fim
+        if (in == NULL) {
+            void *item = out != NULL ? out->items + out->count * st->item_size : NULL;
+
+            if (st->func(NULL, item, st->arg) <= 0) {
+                break;
+            }
+
+            items_out++;
+            if (out != NULL) {
+                batch_push(st, out);
+            }
+            continue;
+        }
+
+        // sem lotes a receber, o lote parcial segue adiante em vez de
+        // aguardar os próximos itens
+        if (out != NULL && out->count > 0 && mqueue_msgs(&st->queue) == 0) {
+            batch_send(st, out);
+        }
+
+        unsigned int start = systime();
+
+        mqueue_recv(&st->queue, in);
+        recv_wait += systime() - start;
+
+        if (in->count < 0) {
+            break;
+        }
+
+        for (int i = 0; i < in->count; i++) {
+            void *item = out != NULL ? out->items + out->count * st->item_size : NULL;
+
+            items_in++;
+            if (st->func(in->items + i * st->in_size, item, st->arg) > 0 && out != NULL) {
+                items_out++;
+                batch_push(st, out);
+            }
+        }
+    }
+
+    if (out != NULL && out->count > 0) {
+        batch_send(st, out);
+    }
+
+    unsigned int busy = task_proctime();
+
+    enter_cs(&st->lock);
+    st->items_in += items_in;
+    st->items_out += items_out;
+    st->recv_wait += recv_wait;
+    st->busy += busy;
+    st->end = systime();
+    int last = --st->running == 0;
+    leave_cs(&st->lock);
+
+    if (last && st->next != NULL) {
+        stage_close(st->next, out);
+    }
+
+    free(in);
+    free(out);
+
+    task_exit(0);
+}
+
+int pipeline_create(pipeline_t *pipe) {
+    if (pipe == NULL || pipe->active) {
+        return -1;
+    }
+
+    memset(pipe, 0, sizeof(pipeline_t));
+    pipe->active = 1;
+
+    return 0;
+}
+
+int pipeline_stage(pipeline_t *pipe, const char *name, stage_func_t func, void *arg,
+                   int item_size, int parallelism, int capacity) {
+    if (pipe == NULL || pipe->active == 0 || pipe->running || pipe->count == PIPELINE_STAGES ||
+        func == NULL || item_size < 0 || parallelism < 1 || capacity < 1) {
+        return -1;
+    }
+
+    stage_t *st = &pipe->stages[pipe->count];
+
+    memset(st, 0, sizeof(stage_t));
+    st->name = name != NULL ? name : "-";
+    st->func = func;
+    st->arg = arg;
+    st->item_size = item_size;
+    st->parallelism = parallelism;
+    st->capacity = capacity;
+
+    return pipe->count++;
+}
+
+int pipeline_connect(pipeline_t *pipe, int from, int to) {
+    if (pipe == NULL || pipe->active == 0 || pipe->running || from < 0 || to < 0 ||
+        from >= pipe->count || to >= pipe->count) {
+        return -1;
+    }
+
+    stage_t *src = &pipe->stages[from];
+    stage_t *dst = &pipe->stages[to];
+
+    // uma única saída, com itens do tamanho esperado pelo destino
+    if (src->next != NULL || src->item_size == 0 ||
+        (dst->in_size > 0 && dst->in_size != src->item_size)) {
+        return -1;
+    }
+
+    // a ligação não pode fechar um ciclo
+    for (stage_t *st = dst; st != NULL; st = st->next) {
+        if (st == src) {
+            return -1;
+        }
+    }
+
+    src->next = dst;
+    dst->in_size = src->item_size;
+    dst->inputs++;
+
+    return 0;
+}
+
+int pipeline_run(pipeline_t *pipe) {
+    if (pipe == NULL || pipe->active == 0 || pipe->running || pipe->count == 0) {
+        return -1;
+    }
+
+    // todas as filas existem antes que algum worker comece a enviar
+    for (int i = 0; i < pipe->count; i++) {
+        stage_t *st = &pipe->stages[i];
+        int max = (st->capacity + PIPELINE_BATCH - 1) / PIPELINE_BATCH;
+
+        if ((st->workers = malloc(st->parallelism * sizeof(task_t *))) == NULL ||
+            (st->in_size > 0 && mqueue_create(&st->queue, max, batch_size(st->in_size)) < 0)) {
+            perror("Erro ao criar as filas do pipeline");
+            exit(1);
+        }
+
+        st->running = st->parallelism;
+    }
+
+    pipe->start = systime();
+    pipe->running = 1;
+
+    for (int i = 0; i < pipe->count; i++) {
+        stage_t *st = &pipe->stages[i];
+
+        for (int j = 0; j < st->parallelism; j++) {
+            if ((st->workers[j] = task_spawn(stage_worker, st)) == NULL) {
+                perror("Erro ao criar os workers do pipeline");
+                exit(1);
+            }
+        }
+    }
+
+    return 0;
+}
+
+int pipeline_wait(pipeline_t *pipe) {
+    if (pipe == NULL || pipe->active == 0 || pipe->running == 0 ||
+        current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    stage_t *bottleneck = NULL;
+
+    for (int i = 0; i < pipe->count; i++) {
+        stage_t *st = &pipe->stages[i];
+
+        for (int j = 0; j < st->parallelism; j++) {
+            task_join(st->workers[j]);
+        }
+
+        // o gargalo é o estágio com mais processamento por worker
+        if (bottleneck == NULL ||
+            st->busy / st->parallelism > bottleneck->busy / bottleneck->parallelism) {
+            bottleneck = st;
+        }
+    }
+
+    for (int i = 0; i < pipe->count; i++) {
+        stage_t *st = &pipe->stages[i];
+
+        if (print_stats) {
+            unsigned long items = st->in_size > 0 ? st->items_in : st->items_out;
+            unsigned int elapsed = st->end - pipe->start;
+
+            printf("Stage %d (%s): %d workers, %lu in, %lu out, %lu items/s, %lu batches, "
+                   "queue max %d/%d avg %llu, busy %u ms, send wait %u ms, recv wait %u ms\n",
+                   i, st->name, st->parallelism, st->items_in, st->items_out,
+                   elapsed > 0 ? items * 1000 / elapsed : items, st->batches, st->max_depth,
+                   st->in_size > 0 ? st->queue.capacity : 0,
+                   st->batches > 0 ? st->depth_sum / st->batches : 0, st->busy, st->send_wait,
+                   st->recv_wait);
+        }
+
+        if (st->in_size > 0) {
+            mqueue_destroy(&st->queue);
+        }
+        free(st->workers);
+    }
+
+    if (print_stats) {
+        printf("Pipeline: %u ms, bottleneck %s\n", systime() - pipe->start, bottleneck->name);
+    }
+
+    pipe->running = 0;
+    pipe->active = 0;
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+// Pools de tarefas: um conjunto fixo de tarefas (workers) executa trabalhos
+// curtos, pares (função, argumento), retirados de filas por prioridade. Um
+// trabalho custa uma inserção na fila e um sem_up, em vez da criação e do
+// encerramento de uma tarefa. Os workers são tarefas comuns: disputam o
+// processador com as demais, são preemptados normalmente e, enquanto
+// executam um trabalho, assumem a prioridade dele.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppos.h"
+
+extern __thread task_t *current_task;
+extern __thread task_t *cpu_dispatcher;
+extern int print_stats;
+
+extern void enter_cs(int *lock);
+extern void leave_cs(int *lock);
+
+// retira o próximo trabalho, o da fila de maior prioridade, ou NULL se as
+// filas estão vazias; chamada com pool->lock obtida
+static job_t *pool_pop(task_pool_t *pool) {
+    if (pool->map == 0) {
+        return NULL;
+    }
+
+    int p = __builtin_ctzll(pool->map);
+    job_t *job = pool->head[p];
+
+    if ((pool->head[p] = job->next) == NULL) {
+        pool->tail[p] = NULL;
+        pool->map &= ~(1ULL << p);
+    }
+    pool->depth--;
+
+    return job;
+}
+
+// corpo dos workers: executa trabalhos até as filas ficarem vazias durante o
+// encerramento do pool
+static void pool_worker(void *arg) {
+    task_pool_t *pool = arg;
+
+    for (;;) {
+        sem_down(&pool->s_jobs);
+
+        enter_cs(&pool->lock);
+        job_t *job = pool_pop(pool);
+
+        if (job != NULL) {
+            unsigned int latency = systime() - job->submitted;
+
+            pool->latency_sum += latency;
+            if (latency > pool->max_latency) {
+                pool->max_latency = latency;
+            }
+        }
+        leave_cs(&pool->lock);
+
+        if (job == NULL) {
+            break;
+        }
+
+        task_setprio(NULL, job->prio);
+        job->func(job->arg);
+
+        // o último trabalho pendente libera as tarefas que o aguardam
+        enter_cs(&pool->lock);
+        job->next = pool->free_jobs;
+        pool->free_jobs = job;
+        pool->jobs++;
+
+        int waiting = --pool->pending == 0 ? pool->waiting : 0;
+
+        if (waiting > 0) {
+            pool->waiting = 0;
+        }
+        leave_cs(&pool->lock);
+
+        while (waiting-- > 0) {
+            sem_up(&pool->s_idle);
+        }
+    }
+
+    task_exit(0);
+}
+
+int task_pool_create(task_pool_t *pool, int size) {
+    if (pool == NULL || pool->active || size <= 0) {
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(task_pool_t));
+
+    if ((pool->workers = malloc(size * sizeof(task_t *))) == NULL) {
+        return -1;
+    }
+
+    sem_create(&pool->s_jobs, 0);
+    sem_create(&pool->s_idle, 0);
+    pool->active = 1;
+
+    for (pool->size = 0; pool->size < size; pool->size++) {
+        if ((pool->workers[pool->size] = task_spawn(pool_worker, pool)) == NULL) {
+            task_pool_destroy(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int task_pool_submit(task_pool_t *pool, void (*func)(void *), void *arg, int prio) {
+    if (pool == NULL || pool->active == 0 || func == NULL) {
+        return -1;
+    }
+
+    // verifica os limites da prioridade fornecida
+    if (prio < MAX_PRIORITY) {
+        prio = MAX_PRIORITY;
+    } else if (prio > MIN_PRIORITY) {
+        prio = MIN_PRIORITY;
+    }
+
+    // os trabalhos concluídos são reutilizados
+    enter_cs(&pool->lock);
+    job_t *job = pool->free_jobs;
+
+    if (job != NULL) {
+        pool->free_jobs = job->next;
+    }
+    leave_cs(&pool->lock);
+
+    if (job == NULL && (job = malloc(sizeof(job_t))) == NULL) {
+        return -1;
+    }
+
+    int p = prio - MAX_PRIORITY;
+
+    job->next = NULL;
+    job->func = func;
+    job->arg = arg;
+    job->prio = prio;
+    job->submitted = systime();
+
+    // insere o trabalho no fim da fila da sua prioridade
+    enter_cs(&pool->lock);
+    if (pool->tail[p] != NULL) {
+        pool->tail[p]->next = job;
+    } else {
+        pool->head[p] = job;
+    }
+    pool->tail[p] = job;
+    pool->map |= 1ULL << p;
+    pool->pending++;
+    pool->depth++;
+    pool->depth_sum += pool->depth;
+
+    if (pool->depth > pool->max_depth) {
+        pool->max_depth = pool->depth;
+    }
+    leave_cs(&pool->lock);
+
+    return sem_up(&pool->s_jobs);
+}
+
+int task_pool_wait(task_pool_t *pool) {
+    if (pool == NULL || pool->active == 0 || current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    enter_cs(&pool->lock);
+    if (pool->pending == 0) {
+        leave_cs(&pool->lock);
+        return 0;
+    }
+
+    pool->waiting++;
+    leave_cs(&pool->lock);
+
+    return sem_down(&pool->s_idle);
+}
+
+int task_pool_destroy(task_pool_t *pool) {
+    if (pool == NULL || pool->active == 0 || current_task == cpu_dispatcher) {
+        return -1;
+    }
+
+    // os trabalhos pendentes são concluídos; depois disso, cada worker
+    // encontra as filas vazias e termina
+    task_pool_wait(pool);
+    pool->active = 0;
+
+    for (int i = 0; i < pool->size; i++) {
+        sem_up(&pool->s_jobs);
+    }
+
+    for (int i = 0; i < pool->size; i++) {
+        task_join(pool->workers[i]);
+    }
+
+    sem_destroy(&pool->s_jobs);
+    sem_destroy(&pool->s_idle);
+
+    while (pool->free_jobs != NULL) {
+        job_t *job = pool->free_jobs;
+
+        pool->free_jobs = job->next;
+        free(job);
+    }
+
+    free(pool->workers);
+
+    unsigned int done = pool->jobs > 0 ? pool->jobs : 1;
+
+    if (print_stats) {
+        printf("Job pool: %d workers, %u jobs, queue depth max %d avg %llu, latency max %u ms avg %llu ms\n",
+               pool->size, pool->jobs, pool->max_depth, pool->depth_sum / done,
+               pool->max_latency, pool->latency_sum / done);
+    }
+
+    return 0;
+}
@@ -0,0 +1,596 @@
+// Políticas de escalonamento do núcleo. Cada política implementa as operações
+// de sched_class_t sobre a sua própria fila de prontas; o dispatcher e todos
+// os caminhos que tornam uma tarefa pronta usam apenas essas operações.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppos.h"
+
+// print_elem é passada para a função queue_print, utilizada em mensagens de
+// depuração, para acompanhar o uso da fila de tarefas prontas.
+__attribute__((unused)) static void print_elem(void *ptr) {
+    printf("%d", ((task_t *)ptr)->id);
+}
+
+// ajusta as prioridades estática e dinâmica de uma tarefa
+static inline void set_prio(task_t *task, int prio) {
+    task->static_prio = prio;
+    task->dynamic_prio = prio;
+}
+
+// política por prioridades dinâmicas com envelhecimento ======================
+
+// fila de prontas: uma fila por nível de prioridade dinâmica, subdividida por
+// prioridade estática para o desempate; os mapas de bits indicam as filas não
+// vazias, permitindo encontrar a próxima tarefa sem percorrer a fila inteira.
+// O envelhecimento é preguiçoso: cada decisão do escalonador avança uma época
+// e os níveis formam um anel, indexado pela chave de envelhecimento da tarefa
+// (prioridade ao ficar pronta mais as épocas já passadas), de forma que a
+// passagem do tempo apenas gira o anel, sem alterar os descritores.
+static task_t *run_list[PRIO_LEVELS][PRIO_LEVELS];
+static unsigned long long level_map;             // níveis dinâmicos ocupados
+static unsigned long long prio_map[PRIO_LEVELS]; // prioridades estáticas ocupadas
+static unsigned long long epoch = 0;             // decisões de escalonamento
+static unsigned int arrivals = 0;                // tarefas inseridas na fila de prontas
+
+#define AGING_STEP (-(AGING_FACTOR))         // níveis envelhecidos por época
+#define LEVEL_MASK ((1ULL << PRIO_LEVELS) - 1) // níveis válidos em level_map
+
+// chave de envelhecimento da tarefa: o nível em que ela está é a diferença
+// entre essa chave e a base de envelhecimento corrente
+static inline unsigned long long ready_key(task_t *task) {
+    return (task->dynamic_prio - MAX_PRIORITY) + AGING_STEP * task->ready_epoch;
+}
+
+// base de envelhecimento corrente: chave do nível de prioridade máxima
+static inline unsigned long long aging_base(void) {
+    return AGING_STEP * epoch;
+}
+
+// linha da matriz de prontas que guarda a tarefa; as tarefas que já
+// atingiram a prioridade máxima ficam todas na linha da base corrente
+static int ready_row(task_t *task) {
+    unsigned long long key = ready_key(task);
+    unsigned long long base = aging_base();
+
+    return (key < base ? base : key) % PRIO_LEVELS;
+}
+
+// concatena a fila src ao final da fila dst, deixando src vazia
+static void list_splice(task_t **dst, task_t **src) {
+    if (*src == NULL) {
+        return;
+    }
+
+    if (*dst == NULL) {
+        *dst = *src;
+    } else {
+        task_t *first = *dst, *last = first->prev;
+        task_t *src_first = *src, *src_last = src_first->prev;
+
+        last->next = src_first;
+        src_first->prev = last;
+        src_last->next = first;
+        first->prev = src_last;
+    }
+
+    *src = NULL;
+}
+
+// insere uma tarefa na fila de prontas por prioridades
+static void prio_enqueue(task_t *task) {
+    task->ready_epoch = epoch;
+    task->ready_seq = arrivals++;
+
+    int s = task->static_prio - MAX_PRIORITY;
+    int d = ready_row(task);
+
+    queue_append((queue_t **)&run_list[d][s], (queue_t *)task);
+    prio_map[d] |= 1ULL << s;
+    level_map |= 1ULL << d;
+}
+
+// retira uma tarefa da fila de prontas por prioridades
+static void prio_dequeue(task_t *task) {
+    int d = ready_row(task);
+    int s = task->static_prio - MAX_PRIORITY;
+
+    queue_remove((queue_t **)&run_list[d][s], (queue_t *)task);
+
+    if (run_list[d][s] == NULL) {
+        prio_map[d] &= ~(1ULL << s);
+
+        if (prio_map[d] == 0) {
+            level_map &= ~(1ULL << d);
+        }
+    }
+}
+
+// avança uma época de envelhecimento: o anel de níveis gira e as linhas que
+// ultrapassaram a prioridade máxima são fundidas à linha da nova base, com as
+// tarefas mais antigas à frente
+static void prio_age(void) {
+    unsigned long long old_base = aging_base();
+
+    epoch++;
+
+    int dest = aging_base() % PRIO_LEVELS;
+
+    for (unsigned long long key = old_base; key < aging_base(); key++) {
+        int d = key % PRIO_LEVELS;
+        unsigned long long map = prio_map[d];
+
+        if (map == 0) {
+            continue;
+        }
+
+        while (map != 0) {
+            int s = __builtin_ctzll(map);
+
+            map &= map - 1;
+            list_splice(&run_list[d][s], &run_list[dest][s]);
+            run_list[dest][s] = run_list[d][s];
+            run_list[d][s] = NULL;
+        }
+
+        prio_map[dest] |= prio_map[d];
+        prio_map[d] = 0;
+        level_map = (level_map & ~(1ULL << d)) | (1ULL << dest);
+    }
+}
+
+// escolhe e retira da fila a tarefa de maior prioridade dinâmica
+static task_t *prio_pick_next(void) {
+    if (level_map == 0) {
+        return NULL;
+    }
+
+    // gira o mapa de níveis para que o bit 0 corresponda à prioridade máxima
+    int base = aging_base() % PRIO_LEVELS;
+    unsigned long long map = ((level_map >> base) | (level_map << (PRIO_LEVELS - base))) & LEVEL_MASK;
+
+    // a próxima tarefa será aquela com a maior prioridade dinâmica; em caso
+    // de empate, a próxima tarefa será aquela com maior prioridade estática
+    int d = (base + __builtin_ctzll(map)) % PRIO_LEVELS;
+    int s = __builtin_ctzll(prio_map[d]);
+    task_t *next_task = run_list[d][s];
+
+    prio_dequeue(next_task);
+
+    // envelhecimento das tarefas não escolhidas
+    prio_age();
+
+    // reseta a prioridade dinâmica da nova tarefa a ser executada
+    next_task->dynamic_prio = next_task->static_prio;
+
+    return next_task;
+}
+
+// uma tarefa pronta muda de fila conforme a nova prioridade, mas mantém a
+// sua posição relativa: fica à frente das tarefas que ficaram prontas depois
+// dela, como na fila de prontas única
+static void prio_setprio(task_t *task, int prio) {
+    if (task->status != READY) {
+        set_prio(task, prio);
+        return;
+    }
+
+    unsigned int arrival = task->ready_seq;
+
+    prio_dequeue(task);
+    set_prio(task, prio);
+    prio_enqueue(task);
+    task->ready_seq = arrival;
+
+    task_t **list = &run_list[ready_row(task)][task->static_prio - MAX_PRIORITY];
+    task_t *pos = *list;
+
+    while (pos != task && (int)(pos->ready_seq - arrival) < 0) {
+        pos = pos->next;
+    }
+
+    if (pos == task) {
+        return;
+    }
+
+    // a tarefa, inserida no final, passa para antes de pos
+    queue_remove((queue_t **)list, (queue_t *)task);
+    task->prev = pos->prev;
+    task->next = pos;
+    pos->prev->next = task;
+    pos->prev = task;
+
+    if (pos == *list) {
+        *list = task;
+    }
+}
+
+// imprime as filas não vazias da fila de prontas, por nível de prioridade
+static void prio_print(void) {
+    int base = aging_base() % PRIO_LEVELS;
+
+    printf("### [ready_queue] :");
+
+    for (int d = 0; d < PRIO_LEVELS; d++) {
+        int row = (base + d) % PRIO_LEVELS;
+
+        for (int s = 0; s < PRIO_LEVELS; s++) {
+            if (run_list[row][s] != NULL) {
+                printf(" (%d,%d)", d + MAX_PRIORITY, s + MAX_PRIORITY);
+                queue_print("", (queue_t *)run_list[row][s], print_elem);
+            }
+        }
+    }
+
+    putchar('\n');
+}
+
+// heaps de tarefas prontas ==================================================
+
+// as políticas justa, por passos e de tempo real mantêm as tarefas prontas em
+// heaps mínimos; cada heap define a sua própria ordem
+typedef struct
+{
+    task_t **items;                    // tarefas, em ordem de heap
+    int size;                          // tarefas no heap
+    int capacity;                      // capacidade do vetor de tarefas
+    int (*less)(task_t *a, task_t *b); // ordem do heap
+} heap_t;
+
+static unsigned long long heap_seq = 0; // ordem de chegada aos heaps
+
+// coloca a tarefa na posição pos do heap, atualizando seu índice
+static inline void heap_place(heap_t *heap, task_t *task, int pos) {
+    heap->items[pos] = task;
+    task->heap_index = pos;
+}
+
+// sobe a tarefa da posição pos até a sua posição correta no heap
+static void heap_sift_up(heap_t *heap, int pos) {
+    task_t *task = heap->items[pos];
+
+    while (pos > 0 && heap->less(task, heap->items[(pos - 1) / 2])) {
+        heap_place(heap, heap->items[(pos - 1) / 2], pos);
+        pos = (pos - 1) / 2;
+    }
+
+    heap_place(heap, task, pos);
+}
+
+// desce a tarefa da posição pos até a sua posição correta no heap
+static void heap_sift_down(heap_t *heap, int pos) {
+    task_t *task = heap->items[pos];
+
+    while (2 * pos + 1 < heap->size) {
+        int child = 2 * pos + 1;
+
+        if (child + 1 < heap->size && heap->less(heap->items[child + 1], heap->items[child])) {
+            child++;
+        }
+
+        if (!heap->less(heap->items[child], task)) {
+            break;
+        }
+
+        heap_place(heap, heap->items[child], pos);
+        pos = child;
+    }
+
+    heap_place(heap, task, pos);
+}
+
+// insere uma tarefa no heap
+static void heap_push(heap_t *heap, task_t *task) {
+    if (heap->size == heap->capacity) {
+        int capacity = heap->capacity ? 2 * heap->capacity : 64;
+        task_t **items = realloc(heap->items, capacity * sizeof(task_t *));
+
+        if (items == NULL) {
+            perror("Erro ao aumentar a fila de prontas");
+            exit(1);
+        }
+
+        heap->items = items;
+        heap->capacity = capacity;
+    }
+
+    task->ready_epoch = heap_seq++;
+    heap_place(heap, task, heap->size++);
+    heap_sift_up(heap, task->heap_index);
+}
+
+// retira uma tarefa do heap
+static void heap_remove(heap_t *heap, task_t *task) {
+    int pos = task->heap_index;
+    task_t *last = heap->items[--heap->size];
+
+    task->heap_index = -1;
+
+    if (last == task) {
+        return;
+    }
+
+    heap_place(heap, last, pos);
+    heap_sift_up(heap, pos);
+    heap_sift_down(heap, last->heap_index);
+}
+
+// retira do heap a primeira tarefa
+static task_t *heap_pop(heap_t *heap) {
+    if (heap->size == 0) {
+        return NULL;
+    }
+
+    task_t *task = heap->items[0];
+
+    heap_remove(heap, task);
+
+    return task;
+}
+
+// imprime as tarefas do heap, na ordem em que estão armazenadas
+static void heap_print(heap_t *heap, const char *name) {
+    printf("### [%s] :", name);
+
+    for (int i = 0; i < heap->size; i++) {
+        printf(" %d", heap->items[i]->id);
+    }
+
+    putchar('\n');
+}
+
+// tempo virtual ==============================================================
+
+// as políticas justa e por passos ordenam as tarefas prontas pelo tempo
+// virtual (vruntime); elas diferem apenas na forma como esse tempo avança
+static unsigned long long min_vruntime = 0; // menor tempo virtual já escolhido
+
+// peso de cada prioridade estática, de MAX_PRIORITY a MIN_PRIORITY: cada
+// nível de prioridade vale cerca de 25% a mais de processador que o seguinte
+static const unsigned int prio_weight[PRIO_LEVELS] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45, 36, 29, 23, 18, 15,
+    12};
+
+#define VTIME_SHIFT 30 // precisão do tempo virtual
+
+// converte ms de processamento em tempo virtual, conforme a prioridade
+static inline unsigned long long vtime(unsigned int ms, int prio) {
+    return ((unsigned long long)ms << VTIME_SHIFT) / prio_weight[prio - MAX_PRIORITY];
+}
+
+// vence o menor tempo virtual e, em caso de empate, a que ficou pronta antes
+static int vruntime_less(task_t *a, task_t *b) {
+    return a->vruntime < b->vruntime ||
+           (a->vruntime == b->vruntime && a->ready_epoch < b->ready_epoch);
+}
+
+static heap_t vruntime_heap = {.less = vruntime_less};
+
+// insere uma tarefa no heap de tempo virtual; uma tarefa que ainda não
+// executou começa no menor tempo virtual e uma tarefa que volta de um
+// bloqueio não acumula mais que credit de vantagem sobre as demais
+static void vruntime_insert(task_t *task, unsigned long long credit) {
+    if (task->activations == 0) {
+        task->vruntime = min_vruntime;
+    } else if (task->vruntime + credit < min_vruntime) {
+        task->vruntime = min_vruntime - credit;
+    }
+
+    heap_push(&vruntime_heap, task);
+}
+
+static void vruntime_dequeue(task_t *task) {
+    heap_remove(&vruntime_heap, task);
+}
+
+// retira do heap a tarefa com o menor tempo virtual
+static task_t *vruntime_pick_next(void) {
+    task_t *next_task = heap_pop(&vruntime_heap);
+
+    // o tempo virtual mínimo do sistema nunca retrocede
+    if (next_task != NULL && next_task->vruntime > min_vruntime) {
+        min_vruntime = next_task->vruntime;
+    }
+
+    return next_task;
+}
+
+// a posição no heap não depende da prioridade, apenas o avanço futuro
+static void vruntime_setprio(task_t *task, int prio) {
+    set_prio(task, prio);
+}
+
+static void vruntime_print(void) {
+    heap_print(&vruntime_heap, "ready_queue");
+}
+
+// política justa =============================================================
+
+// o tempo virtual avança a cada tick de processamento, mais devagar para as
+// tarefas de maior peso; tarefas que voltam de um bloqueio recebem no máximo
+// um quantum de crédito
+static void fair_enqueue(task_t *task) {
+    vruntime_insert(task, vtime(TICKS, 0));
+}
+
+static void fair_on_tick(task_t *task, unsigned int ticks) {
+    task->vruntime += vtime(ticks, task->static_prio);
+}
+
+// política por passos (stride) ===============================================
+
+// a cada ativação a tarefa avança um passo inversamente proporcional ao seu
+// peso, independentemente de quanto do quantum usou; tarefas que voltam de
+// um bloqueio não recebem crédito
+static void stride_enqueue(task_t *task) {
+    vruntime_insert(task, 0);
+}
+
+static task_t *stride_pick_next(void) {
+    task_t *next_task = vruntime_pick_next();
+
+    if (next_task != NULL) {
+        next_task->vruntime += vtime(TICKS, next_task->static_prio);
+    }
+
+    return next_task;
+}
+
+// política circular (round-robin) ============================================
+
+static task_t *rr_queue; // fila única de tarefas prontas
+
+static void rr_enqueue(task_t *task) {
+    queue_append((queue_t **)&rr_queue, (queue_t *)task);
+}
+
+static void rr_dequeue(task_t *task) {
+    queue_remove((queue_t **)&rr_queue, (queue_t *)task);
+}
+
+static task_t *rr_pick_next(void) {
+    task_t *next_task = rr_queue;
+
+    if (next_task != NULL) {
+        rr_dequeue(next_task);
+    }
+
+    return next_task;
+}
+
+static void rr_print(void) {
+    queue_print("### [ready_queue] ", (queue_t *)rr_queue, print_elem);
+}
+
+// tempo real: prazo mais cedo primeiro (EDF) ================================
+
+// as tarefas de tempo real prontas ficam em um heap ordenado pelo prazo
+// absoluto; o núcleo consulta esta classe antes da política corrente, de
+// forma que elas sempre têm preferência sobre as tarefas normais
+
+// vence o prazo mais cedo (sem erro na volta do relógio) e, em caso de
+// empate, a que ficou pronta antes
+static int deadline_less(task_t *a, task_t *b) {
+    int diff = (int)(a->deadline - b->deadline);
+
+    return diff < 0 || (diff == 0 && a->ready_epoch < b->ready_epoch);
+}
+
+static heap_t deadline_heap = {.less = deadline_less};
+
+static void edf_enqueue(task_t *task) {
+    heap_push(&deadline_heap, task);
+}
+
+static void edf_dequeue(task_t *task) {
+    heap_remove(&deadline_heap, task);
+}
+
+static task_t *edf_pick_next(void) {
+    return heap_pop(&deadline_heap);
+}
+
+static void edf_print(void) {
+    heap_print(&deadline_heap, "rt_queue");
+}
+
+// informa se há uma tarefa de tempo real pronta que deve tomar o processador
+// da tarefa indicada
+int edf_preempts(task_t *task) {
+    if (deadline_heap.size == 0) {
+        return 0;
+    }
+
+    return task->rt_deadline == 0 || deadline_less(deadline_heap.items[0], task);
+}
+
+// tabela de políticas ========================================================
+
+static void no_tick(task_t *task, unsigned int ticks) {
+    (void)task;
+    (void)ticks;
+}
+
+static const sched_class_t prio_class = {
+    .name = "prio",
+    .enqueue = prio_enqueue,
+    .dequeue = prio_dequeue,
+    .pick_next = prio_pick_next,
+    .on_tick = no_tick,
+    .on_setprio = prio_setprio,
+    .print = prio_print,
+};
+
+static const sched_class_t fair_class = {
+    .name = "fair",
+    .enqueue = fair_enqueue,
+    .dequeue = vruntime_dequeue,
+    .pick_next = vruntime_pick_next,
+    .on_tick = fair_on_tick,
+    .on_setprio = vruntime_setprio,
+    .print = vruntime_print,
+};
+
+static const sched_class_t rr_class = {
+    .name = "rr",
+    .enqueue = rr_enqueue,
+    .dequeue = rr_dequeue,
+    .pick_next = rr_pick_next,
+    .on_tick = no_tick,
+    .on_setprio = set_prio,
+    .print = rr_print,
+};
+
+static const sched_class_t stride_class = {
+    .name = "stride",
+    .enqueue = stride_enqueue,
+    .dequeue = vruntime_dequeue,
+    .pick_next = stride_pick_next,
+    .on_tick = no_tick,
+    .on_setprio = vruntime_setprio,
+    .print = vruntime_print,
+};
+
+// classe de tempo real, sempre consultada antes da política corrente
+const sched_class_t edf_class = {
+    .name = "edf",
+    .enqueue = edf_enqueue,
+    .dequeue = edf_dequeue,
+    .pick_next = edf_pick_next,
+    .on_tick = no_tick,
+    .on_setprio = set_prio,
+    .print = edf_print,
+};
+
+// políticas embutidas, indexadas por sched_policy_t
+static const sched_class_t *sched_classes[] = {
+    [POLICY_PRIO] = &prio_class,
+    [POLICY_FAIR] = &fair_class,
+    [POLICY_RR] = &rr_class,
+    [POLICY_STRIDE] = &stride_class,
+};
+
+#define NUM_POLICIES ((int)(sizeof(sched_classes) / sizeof(sched_classes[0])))
+
+const sched_class_t *sched_class(sched_policy_t policy) {
+    if (policy < 0 || policy >= NUM_POLICIES) {
+        return NULL;
+    }
+
+    return sched_classes[policy];
+}
+
+int sched_policy_byname(const char *name) {
+    for (int i = 0; i < NUM_POLICIES; i++) {
+        if (strcmp(sched_classes[i]->name, name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
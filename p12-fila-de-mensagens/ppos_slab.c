@@ -0,0 +1,176 @@
+// Descritores de tarefa alocados pelo núcleo (task_spawn). Os descritores
+// vêm de blocos de descritores contíguos, alinhados às linhas de cache, e
+// voltam ao núcleo quando a tarefa termina e é aguardada ou destacada.
+//
+// Blocos de task_spawn: SLAB_TASKS descritores sem pilha, alocados quando a
+// lista de descritores livres se esgota e nunca devolvidos ao sistema; os
+// descritores reciclados voltam à lista e as pilhas vêm do cache de pilhas.
+//
+// Blocos de task_spawn_n: um único mapeamento com as pilhas e os descritores
+// das n tarefas. As pilhas ficam no início do bloco, uma após a outra, com
+// uma única página de guarda abaixo da primeira, e os descritores acima da
+// última, onde um estouro de pilha não os alcança; não há páginas de guarda
+// entre as pilhas, pois cada uma exigiria um mapeamento próprio. Quando o
+// último dos seus descritores é liberado, o bloco é guardado para a próxima
+// chamada, como as pilhas no cache de pilhas, ou desfeito.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ppos.h"
+
+#define SLAB_TASKS 64 // descritores em cada bloco de task_spawn
+
+// cabeçalho de um bloco, seguido dos seus descritores
+typedef struct
+{
+    int live;          // descritores em uso (blocos de task_spawn_n)
+    int capacity;      // descritores e pilhas no bloco
+    size_t length;     // bytes mapeados, a partir de area
+    char *area;        // início do mapeamento, com a página de guarda
+    char *stacks;      // primeira pilha; NULL se as pilhas vêm do cache
+    size_t stack_size; // tamanho de cada pilha
+    task_t *tasks;     // primeiro descritor do bloco
+} __attribute__((aligned(64))) slab_t;
+
+static task_t *free_tasks = NULL; // descritores livres dos blocos de task_spawn
+static slab_t *spare = NULL;      // último bloco de task_spawn_n desfeito
+static int slab_lock = 0;         // protege a lista de livres e spare
+
+extern int stack_pool_max;
+
+extern void enter_cs(int *lock);
+extern void leave_cs(int *lock);
+extern size_t stack_size(size_t size);
+
+// cria um bloco de SLAB_TASKS descritores e os coloca na lista de livres;
+// chamada com slab_lock obtida
+static int slab_grow(void) {
+    slab_t *slab;
+
+    if (posix_memalign((void **)&slab, 64, sizeof(slab_t) + SLAB_TASKS * sizeof(task_t)) != 0) {
+        return -1;
+    }
+
+    memset(slab, 0, sizeof(slab_t));
+    slab->tasks = (task_t *)(slab + 1);
+
+    for (int i = SLAB_TASKS - 1; i >= 0; i--) {
+        slab->tasks[i].block = slab;
+        slab->tasks[i].next = free_tasks;
+        free_tasks = &slab->tasks[i];
+    }
+
+    return 0;
+}
+
+// obtém um descritor para task_spawn
+task_t *slab_alloc(void) {
+    task_t *task = NULL;
+
+    enter_cs(&slab_lock);
+    if (free_tasks != NULL || slab_grow() == 0) {
+        task = free_tasks;
+        free_tasks = task->next;
+    }
+    leave_cs(&slab_lock);
+
+    return task;
+}
+
+// obtém n descritores consecutivos para task_spawn_n, com as suas pilhas,
+// em um único mapeamento
+task_t *slab_alloc_n(int n) {
+    slab_t *slab = NULL;
+
+    // o bloco guardado serve se tiver ao menos n pilhas; as suas páginas
+    // já tocadas não precisam ser reservadas de novo
+    enter_cs(&slab_lock);
+    if (spare != NULL && spare->capacity >= n) {
+        slab = spare;
+        spare = NULL;
+    }
+    leave_cs(&slab_lock);
+
+    if (slab != NULL) {
+        slab->live = n;
+        return slab->tasks;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = stack_size(STACKSIZE);
+    size_t tasks = (sizeof(slab_t) + n * sizeof(task_t) + page - 1) & ~(page - 1);
+    size_t length = page + n * size + tasks;
+    char *area = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (area == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (mprotect(area, page, PROT_NONE) < 0) {
+        munmap(area, length);
+        return NULL;
+    }
+
+    slab = (slab_t *)(area + page + n * size);
+
+    slab->live = n;
+    slab->capacity = n;
+    slab->length = length;
+    slab->area = area;
+    slab->stacks = area + page;
+    slab->stack_size = size;
+    slab->tasks = (task_t *)(slab + 1);
+
+    for (int i = 0; i < n; i++) {
+        slab->tasks[i].block = slab;
+    }
+
+    return slab->tasks;
+}
+
+// pilha reservada para o descritor no seu bloco, ou NULL se a tarefa obtém a
+// pilha do cache na primeira ativação
+void *slab_stack(task_t *task) {
+    slab_t *slab = task->block;
+
+    if (slab == NULL || slab->stacks == NULL) {
+        return NULL;
+    }
+
+    return slab->stacks + (task - slab->tasks) * slab->stack_size;
+}
+
+// devolve um descritor obtido com slab_alloc ou slab_alloc_n; a tarefa já
+// terminou e deixou a sua pilha
+void slab_free(task_t *task) {
+    slab_t *slab = task->block;
+
+    if (slab->stacks != NULL) {
+        if (__sync_sub_and_fetch(&slab->live, 1) > 0) {
+            return;
+        }
+
+        // o bloco guardado é trocado pelo mais recente
+        enter_cs(&slab_lock);
+        slab_t *old = stack_pool_max > 0 ? spare : slab;
+
+        if (stack_pool_max > 0) {
+            spare = slab;
+        }
+        leave_cs(&slab_lock);
+
+        if (old != NULL) {
+            munmap(old->area, old->length);
+        }
+        return;
+    }
+
+    enter_cs(&slab_lock);
+    task->next = free_tasks;
+    free_tasks = task;
+    leave_cs(&slab_lock);
+}
@@ -0,0 +1,287 @@
+// Execução em várias cpus (M:N): as tarefas são distribuídas entre smp_cpus
+// threads do sistema, cada uma com o seu próprio dispatcher, fila de prontas
+// e fila de adormecidas. Uma tarefa que fica pronta entra na fila da cpu que
+// a acordou e uma cpu sem tarefas prontas rouba metade da fila de outra cpu.
+// No modo particionado (shards) não há roubo: cada tarefa executa sempre na
+// sua cpu e as cpus só se comunicam pelas filas xqueue_t, e cada thread é
+// fixada em um processador do sistema.
+
+// pthread_setaffinity_np é uma extensão GNU
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ppos.h proíbe as funções pthread_* nas aplicações; o núcleo usa apenas as
+// estruturas de dados
+#include "ppos_data.h"
+
+// estado de cada cpu
+typedef struct
+{
+    pthread_t thread;    // thread do sistema que executa a cpu
+    task_t dispatcher;   // descritor do dispatcher da cpu
+    task_t *ready_queue; // fila de prontas local
+    int length;          // tarefas na fila de prontas local
+    int lock;            // protege a fila de prontas local
+    int idle;            // cpu dormindo à espera de um sinal
+} cpu_t;
+
+int smp_cpus = 1;        // número de cpus
+int smp_sharded = 0;     // cpus particionadas, sem roubo de tarefas
+__thread int cpu_id = 0; // cpu da thread corrente
+
+static cpu_t cpus[MAX_CPUS];
+static int started = 0; // as demais cpus já foram iniciadas
+
+extern __thread task_t *current_task;
+extern __thread task_t *cpu_dispatcher;
+
+extern void dispatcher(void);
+extern void enter_cs(int *lock);
+extern void leave_cs(int *lock);
+
+// print_elem é passada para a função queue_print, utilizada em mensagens de
+// depuração, para acompanhar o uso da fila de tarefas prontas.
+static void print_elem(void *ptr) {
+    printf("%d", ((task_t *)ptr)->id);
+}
+
+// filas de prontas por cpu ===================================================
+
+// a tarefa entra na fila da cpu corrente; uma tarefa nova, ou qualquer
+// tarefa no modo particionado, entra na fila da sua própria cpu
+static void smp_enqueue(task_t *task) {
+    int id = smp_sharded || task->activations == 0 ? task->cpu : cpu_id;
+    cpu_t *cpu = &cpus[id];
+
+    enter_cs(&cpu->lock);
+    queue_append((queue_t **)&cpu->ready_queue, (queue_t *)task);
+    task->cpu = id;
+    cpu->length++;
+    leave_cs(&cpu->lock);
+
+    // uma cpu ociosa só olharia a fila no próximo tick
+    if (id != cpu_id && started && __atomic_load_n(&cpu->idle, __ATOMIC_ACQUIRE)) {
+        pthread_kill(cpu->thread, SMP_TICK_SIGNAL);
+    }
+}
+
+// trava as filas de duas cpus, sempre na mesma ordem, para evitar impasses
+static void lock_pair(cpu_t *a, cpu_t *b) {
+    if (a < b) {
+        enter_cs(&a->lock);
+        enter_cs(&b->lock);
+    } else {
+        enter_cs(&b->lock);
+        enter_cs(&a->lock);
+    }
+}
+
+static void unlock_pair(cpu_t *a, cpu_t *b) {
+    leave_cs(&a->lock);
+    leave_cs(&b->lock);
+}
+
+static void smp_dequeue(task_t *task) {
+    cpu_t *cpu;
+
+    // a tarefa pode ser roubada por outra cpu enquanto a trava é obtida
+    for (;;) {
+        cpu = &cpus[task->cpu];
+        enter_cs(&cpu->lock);
+
+        if (cpu == &cpus[task->cpu]) {
+            break;
+        }
+
+        leave_cs(&cpu->lock);
+    }
+
+    queue_remove((queue_t **)&cpu->ready_queue, (queue_t *)task);
+    cpu->length--;
+    leave_cs(&cpu->lock);
+}
+
+// move para a fila da cpu metade das tarefas prontas da primeira outra cpu
+// que as tiver; as tarefas mais antigas, no início da fila, são as roubadas
+static void steal(cpu_t *cpu) {
+    for (int i = 1; i < smp_cpus; i++) {
+        cpu_t *victim = &cpus[(cpu_id + i) % smp_cpus];
+
+        if (victim->length == 0) {
+            continue;
+        }
+
+        lock_pair(cpu, victim);
+
+        int n = (victim->length + 1) / 2;
+
+        while (n-- > 0 && victim->ready_queue != NULL) {
+            task_t *task = victim->ready_queue;
+
+            queue_remove((queue_t **)&victim->ready_queue, (queue_t *)task);
+            victim->length--;
+            queue_append((queue_t **)&cpu->ready_queue, (queue_t *)task);
+            task->cpu = cpu_id;
+            cpu->length++;
+        }
+
+        unlock_pair(cpu, victim);
+
+        if (cpu->length > 0) {
+            return;
+        }
+    }
+}
+
+static task_t *smp_pick_next(void) {
+    cpu_t *cpu = &cpus[cpu_id];
+
+    if (cpu->length == 0 && !smp_sharded) {
+        steal(cpu);
+    }
+
+    enter_cs(&cpu->lock);
+
+    task_t *task = cpu->ready_queue;
+
+    if (task != NULL) {
+        queue_remove((queue_t **)&cpu->ready_queue, (queue_t *)task);
+        cpu->length--;
+    }
+
+    leave_cs(&cpu->lock);
+
+    return task;
+}
+
+static void smp_on_tick(task_t *task, unsigned int ticks) {
+    (void)task;
+    (void)ticks;
+}
+
+// as filas locais são circulares; a prioridade apenas fica registrada
+static void smp_setprio(task_t *task, int prio) {
+    task->static_prio = prio;
+    task->dynamic_prio = prio;
+}
+
+static void smp_print(void) {
+    char name[32];
+
+    for (int i = 0; i < smp_cpus; i++) {
+        snprintf(name, sizeof(name), "### [cpu %d] ", i);
+        queue_print(name, (queue_t *)cpus[i].ready_queue, print_elem);
+    }
+}
+
+const sched_class_t smp_class = {
+    .name = "smp",
+    .enqueue = smp_enqueue,
+    .dequeue = smp_dequeue,
+    .pick_next = smp_pick_next,
+    .on_tick = smp_on_tick,
+    .on_setprio = smp_setprio,
+    .print = smp_print,
+};
+
+// threads das cpus ===========================================================
+
+// fixa a thread da cpu no processador de mesma ordem entre os permitidos,
+// circularmente; se não for possível, a thread continua livre
+static void cpu_pin(cpu_t *cpu, int id, cpu_set_t *allowed) {
+    cpu_set_t set;
+    int n = CPU_COUNT(allowed), count = 0;
+
+    for (int i = 0; i < CPU_SETSIZE && n > 0; i++) {
+        if (CPU_ISSET(i, allowed) && count++ == id % n) {
+            CPU_ZERO(&set);
+            CPU_SET(i, &set);
+            pthread_setaffinity_np(cpu->thread, sizeof(set), &set);
+            return;
+        }
+    }
+}
+
+static void *cpu_main(void *arg) {
+    cpu_t *cpu = arg;
+
+    cpu_id = cpu - cpus;
+    current_task = &cpu->dispatcher;
+    cpu_dispatcher = &cpu->dispatcher;
+
+    // a cpu passa a receber os ticks apenas depois de ter uma tarefa corrente
+    pthread_sigmask(SIG_SETMASK, &cpu->dispatcher.context.uc_sigmask, NULL);
+
+    dispatcher();
+
+    return NULL;
+}
+
+// inicia as demais cpus; chamada pelo dispatcher da cpu 0, quando o contexto
+// da main já está salvo e ela pode ser escolhida por qualquer cpu
+void smp_start(void) {
+    sigset_t ticks, mask;
+    cpu_set_t allowed;
+
+    cpus[0].thread = pthread_self();
+
+    // as threads herdam a máscara de sinais; os ticks ficam bloqueados até
+    // que cada cpu esteja pronta para tratá-los
+    sigemptyset(&ticks);
+    sigaddset(&ticks, SIGALRM);
+    sigaddset(&ticks, SMP_TICK_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &ticks, &mask);
+
+    for (int i = 1; i < smp_cpus; i++) {
+        cpu_t *cpu = &cpus[i];
+
+        // o dispatcher da cpu executa na pilha da própria thread
+        memset(&cpu->dispatcher, 0, sizeof(task_t));
+        cpu->dispatcher.id = 1;
+        cpu->dispatcher.is_sys_task = 1;
+        cpu->dispatcher.status = RUNNING;
+        cpu->dispatcher.heap_index = -1;
+        cpu->dispatcher.context.uc_sigmask = mask;
+
+        if (pthread_create(&cpu->thread, NULL, cpu_main, cpu) != 0) {
+            perror("Erro ao criar a thread da cpu");
+            exit(1);
+        }
+    }
+
+    // no modo particionado cada cpu só executa as suas tarefas, cujos dados
+    // ficam no cache do processador em que a thread permanece
+    if (smp_sharded && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int i = 0; i < smp_cpus; i++) {
+            cpu_pin(&cpus[i], i, &allowed);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    started = 1;
+}
+
+// marca a cpu corrente como ociosa (ou não), para que uma tarefa que fique
+// pronta nela a acorde
+void smp_idle(int idle) {
+    __atomic_store_n(&cpus[cpu_id].idle, idle, __ATOMIC_RELEASE);
+}
+
+// repassa o tick do relógio às demais cpus
+void smp_kick(void) {
+    if (!started) {
+        return;
+    }
+
+    for (int i = 0; i < smp_cpus; i++) {
+        if (i != cpu_id) {
+            pthread_kill(cpus[i].thread, SMP_TICK_SIGNAL);
+        }
+    }
+}
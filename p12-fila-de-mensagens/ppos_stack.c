@@ -0,0 +1,371 @@
+// Pilhas das tarefas. Cada pilha é um mapeamento anônimo próprio, com uma
+// página de guarda sem acesso logo abaixo dela: um estouro de pilha
+// interrompe o programa em vez de corromper a memória vizinha. O sistema só
+// reserva memória física para as páginas efetivamente tocadas, de modo que a
+// memória ocupada acompanha o uso real da pilha, não o seu tamanho.
+//
+// Cache de pilhas: em vez de desfazer o mapeamento da pilha de cada tarefa
+// encerrada, o núcleo a guarda em uma lista de pilhas livres do seu tamanho
+// e a reutiliza na próxima tarefa, evitando as chamadas de sistema em cargas
+// com muitas tarefas curtas. Os tamanhos são arredondados para potências de
+// 2, uma lista por faixa, e cada lista guarda no máximo stack_pool_max
+// pilhas; as demais são devolvidas ao sistema.
+//
+// Pilha compartilhada: as tarefas criadas com copy_stack executam todas na
+// mesma pilha; ao dar lugar a outra, apenas a parte usada da pilha de uma
+// tarefa é copiada para um buffer do tamanho dessa parte, de onde é copiada
+// de volta quando a tarefa retoma (veja task_switch).
+//
+// Devolução de memória: a parte de uma pilha abaixo do ponto em que a tarefa
+// parou não guarda nada útil; enquanto a tarefa está bloqueada há muito
+// tempo, as páginas dessa parte são devolvidas ao sistema com madvise e
+// voltam zeradas se a tarefa precisar delas novamente.
+//
+// Medição do uso das pilhas (stack_check): cada pilha é pintada com um
+// padrão ao ser entregue a uma tarefa e, no encerramento da tarefa, a parte
+// da pilha em que o padrão foi sobrescrito indica o seu uso máximo.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ppos.h"
+
+#define STACK_MIN 4096  // menor faixa de tamanho de pilha
+#define STACK_BUCKETS 16 // faixas de STACK_MIN a STACK_MIN << 15 bytes
+#define STACK_PAINT 0xa5a5a5a5a5a5a5a5ULL // padrão das pilhas medidas
+#define COPY_GRAIN 256   // granularidade dos buffers de cópia
+#define MINCORE_CHUNK 256 // páginas consultadas por chamada a mincore
+
+// pilha livre; o encadeamento fica no topo da própria pilha, a única página
+// que certamente já está reservada
+typedef struct free_stack_t {
+    struct free_stack_t *next;
+} free_stack_t;
+
+int stack_pool_max = STACK_POOL; // pilhas guardadas em cada faixa
+int stack_check = 0;             // mede o uso máximo das pilhas
+
+static free_stack_t *pool[STACK_BUCKETS]; // pilhas livres de cada faixa
+static int pool_length[STACK_BUCKETS];    // pilhas em cada lista
+static int pool_lock = 0;                 // protege as listas e os contadores
+static unsigned int hits = 0;             // pilhas obtidas do cache
+static unsigned int misses = 0;           // pilhas mapeadas pelo sistema
+static unsigned long reserved = 0;        // bytes de pilha mapeados
+static unsigned long reserved_peak = 0;   // maior valor de reserved
+static unsigned long cached = 0;          // bytes de pilha no cache
+static unsigned int copies = 0;           // cópias para a pilha compartilhada
+static unsigned long copy_bytes = 0;      // bytes nos buffers de cópia
+static unsigned long copy_peak = 0;       // maior valor de copy_bytes
+static unsigned long reclaimed = 0;       // bytes de pilha devolvidos
+static unsigned int reclaims = 0;         // pilhas com páginas devolvidas
+static size_t *usage = NULL;              // uso máximo das pilhas medidas
+static int usage_count = 0;               // pilhas medidas
+static int usage_capacity = 0;            // capacidade do vetor usage
+static int usage_lock = 0;                // protege o vetor usage
+
+extern int print_stats;
+
+extern void enter_cs(int *lock);
+extern void leave_cs(int *lock);
+
+// tamanho da página de guarda
+static size_t guard_size(void) {
+    static size_t page = 0;
+
+    if (page == 0) {
+        page = sysconf(_SC_PAGESIZE);
+    }
+
+    return page;
+}
+
+// topo de uma pilha livre, onde fica o encadeamento da lista
+static inline free_stack_t *stack_top(void *stack, size_t size) {
+    return (free_stack_t *)((char *)stack + size) - 1;
+}
+
+// mapeia uma pilha de size bytes precedida pela página de guarda
+static void *stack_map(size_t size) {
+    size_t guard = guard_size();
+    char *area = mmap(NULL, size + guard, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (area == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (mprotect(area, guard, PROT_NONE) < 0) {
+        munmap(area, size + guard);
+        return NULL;
+    }
+
+    return area + guard;
+}
+
+static void stack_unmap(void *stack, size_t size) {
+    size_t guard = guard_size();
+
+    munmap((char *)stack - guard, size + guard);
+}
+
+// faixa do tamanho indicado, ou -1 se for grande demais para o cache
+static int bucket(size_t size) {
+    for (int i = 0; i < STACK_BUCKETS; i++) {
+        if (size <= (size_t)STACK_MIN << i) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// tamanho efetivo da pilha: o da sua faixa, para que possa ser reutilizada
+// por qualquer tarefa da mesma faixa
+size_t stack_size(size_t size) {
+    int i = bucket(size);
+
+    return i < 0 ? size : (size_t)STACK_MIN << i;
+}
+
+// obtém uma pilha de stack_size(size) bytes, do cache se possível
+void *stack_alloc(size_t size) {
+    int i = bucket(size);
+    void *stack = NULL;
+
+    size = stack_size(size);
+
+    enter_cs(&pool_lock);
+    if (i >= 0 && pool[i] != NULL) {
+        stack = (char *)(pool[i] + 1) - size;
+        pool[i] = pool[i]->next;
+        pool_length[i]--;
+        cached -= size;
+        hits++;
+    } else {
+        misses++;
+    }
+    leave_cs(&pool_lock);
+
+    if (stack == NULL && (stack = stack_map(size)) != NULL) {
+        unsigned long total = __sync_add_and_fetch(&reserved, size);
+
+        if (total > reserved_peak) {
+            reserved_peak = total; // aproximado, com várias cpus
+        }
+    }
+
+    return stack;
+}
+
+// devolve uma pilha obtida com stack_alloc(size)
+void stack_free(void *stack, size_t size) {
+    int i = bucket(size);
+
+    if (stack == NULL) {
+        return;
+    }
+
+    size = stack_size(size);
+
+    enter_cs(&pool_lock);
+    if (i >= 0 && pool_length[i] < stack_pool_max) {
+        stack_top(stack, size)->next = pool[i];
+        pool[i] = stack_top(stack, size);
+        pool_length[i]++;
+        cached += size;
+        stack = NULL;
+    }
+    leave_cs(&pool_lock);
+
+    if (stack != NULL) {
+        __sync_fetch_and_sub(&reserved, size);
+        stack_unmap(stack, size);
+    }
+}
+
+// copia size bytes a partir de from para o buffer *buf, de capacidade
+// *capacity, que é ajustado quando fica pequeno ou grande demais
+void stack_copy_out(void **buf, size_t *capacity, void *from, size_t size) {
+    if (size > *capacity || size < *capacity / 2) {
+        size_t new = (size + COPY_GRAIN - 1) / COPY_GRAIN * COPY_GRAIN;
+        void *b = realloc(*buf, new);
+
+        if (b == NULL) {
+            perror("Erro ao salvar a pilha compartilhada");
+            exit(1);
+        }
+
+        copy_bytes += new - *capacity;
+        if (copy_bytes > copy_peak) {
+            copy_peak = copy_bytes;
+        }
+        *buf = b;
+        *capacity = new;
+    }
+
+    memcpy(*buf, from, size);
+}
+
+// copia de volta para a pilha compartilhada o conteúdo salvo de uma tarefa
+void stack_copy_in(void *to, void *buf, size_t size) {
+    memcpy(to, buf, size);
+    copies++;
+}
+
+void stack_copy_free(void *buf, size_t capacity) {
+    copy_bytes -= capacity;
+    free(buf);
+}
+
+// páginas ocupadas de [start, end), alinhados à página; o vetor de mincore
+// tem tamanho fixo, pois a consulta pode executar na pilha do dispatcher
+static size_t resident_pages(uintptr_t start, uintptr_t end, size_t page) {
+    unsigned char vec[MINCORE_CHUNK];
+    size_t resident = 0;
+
+    while (start < end) {
+        size_t pages = (end - start) / page;
+
+        if (pages > MINCORE_CHUNK) {
+            pages = MINCORE_CHUNK;
+        }
+
+        if (mincore((void *)start, pages * page, vec) == 0) {
+            for (size_t i = 0; i < pages; i++) {
+                resident += vec[i] & 1;
+            }
+        }
+
+        start += pages * page;
+    }
+
+    return resident;
+}
+
+// devolve ao sistema as páginas da pilha abaixo de low, o início da parte
+// usada; retorna quantos bytes estavam de fato ocupados
+size_t stack_reclaim(void *stack, void *low) {
+    size_t page = guard_size();
+    uintptr_t start = ((uintptr_t)stack + page - 1) & ~(page - 1);
+    uintptr_t end = (uintptr_t)low & ~(page - 1);
+
+    if (end <= start) {
+        return 0;
+    }
+
+    // conta as páginas ocupadas, para informar o ganho real
+    size_t resident = resident_pages(start, end, page);
+
+    if (resident == 0 || madvise((void *)start, end - start, MADV_DONTNEED) < 0) {
+        return 0;
+    }
+
+    reclaimed += resident * page;
+    reclaims++;
+
+    return resident * page;
+}
+
+// pinta a pilha inteira com o padrão de medição; todas as suas páginas
+// passam a ocupar memória
+void stack_paint(void *stack, size_t size) {
+    uint64_t *word = stack;
+    uint64_t *end = (uint64_t *)((char *)stack + size);
+
+    while (word < end) {
+        *word++ = STACK_PAINT;
+    }
+}
+
+// uso máximo de uma pilha pintada, em bytes: a pilha cresce para baixo, do
+// topo até a palavra mais baixa que não guarda mais o padrão. A medida entra
+// no resumo impresso no encerramento do sistema.
+size_t stack_usage(void *stack, size_t size) {
+    uint64_t *word = stack;
+    uint64_t *end = (uint64_t *)((char *)stack + size);
+
+    while (word < end && *word == STACK_PAINT) {
+        word++;
+    }
+
+    size_t used = (char *)end - (char *)word;
+
+    enter_cs(&usage_lock);
+    if (usage_count == usage_capacity) {
+        int capacity = usage_capacity ? 2 * usage_capacity : 64;
+        size_t *v = realloc(usage, capacity * sizeof(size_t));
+
+        if (v != NULL) {
+            usage = v;
+            usage_capacity = capacity;
+        }
+    }
+
+    if (usage_count < usage_capacity) {
+        usage[usage_count++] = used;
+    }
+    leave_cs(&usage_lock);
+
+    return used;
+}
+
+static int compare_usage(const void *a, const void *b) {
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// memória física ocupada pelas pilhas do cache, em bytes
+static unsigned long cached_resident(void) {
+    size_t page = guard_size();
+    unsigned long resident = 0;
+
+    enter_cs(&pool_lock);
+    for (int i = 0; i < STACK_BUCKETS; i++) {
+        size_t size = (size_t)STACK_MIN << i;
+
+        for (free_stack_t *f = pool[i]; f != NULL; f = f->next) {
+            uintptr_t start = (uintptr_t)(f + 1) - size;
+
+            resident += resident_pages(start, start + size, page) * page;
+        }
+    }
+    leave_cs(&pool_lock);
+
+    return resident;
+}
+
+// imprime, no encerramento do sistema, as estatísticas do cache com
+// PPOS_STATS=1 e o uso das pilhas, se medido. Os bytes reservados são os
+// mapeados; apenas as páginas tocadas ocupam memória física
+void stack_print(void) {
+    if (print_stats) {
+        printf("Stack pool: %u hits, %u misses, %lu KB reserved (peak %lu KB), %lu KB cached "
+               "(%lu KB resident)\n",
+               hits, misses, reserved / 1024, reserved_peak / 1024, cached / 1024,
+               cached_resident() / 1024);
+
+        if (reclaims > 0) {
+            printf("Stack reclaim: %lu KB from %u stacks\n", reclaimed / 1024, reclaims);
+        }
+
+        if (copies > 0) {
+            printf("Shared stack: %u copies, %lu KB in copy buffers (peak %lu KB)\n", copies,
+                   copy_bytes / 1024, copy_peak / 1024);
+        }
+    }
+
+    if (!stack_check || usage_count == 0) {
+        return;
+    }
+
+    qsort(usage, usage_count, sizeof(size_t), compare_usage);
+
+    printf("Stack usage: %d tasks, max %zu bytes, p50 %zu, p90 %zu, p99 %zu bytes\n", usage_count,
+           usage[usage_count - 1], usage[(usage_count - 1) * 50 / 100],
+           usage[(usage_count - 1) * 90 / 100], usage[(usage_count - 1) * 99 / 100]);
+}
@@ -0,0 +1,143 @@
+// Troca de contexto rápida, em assembly, para x86-64 e aarch64. Ao contrário
+// de swapcontext, que salva todo o ucontext_t (inclusive o estado de ponto
+// flutuante) e faz uma chamada de sistema para salvar a máscara de sinais a
+// cada troca, ctx_switch salva na pilha da tarefa apenas os registradores
+// que a convenção de chamada manda preservar e guarda o ponteiro de pilha no
+// descritor da tarefa.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ppos_data.h"
+
+#ifdef FAST_SWITCH
+
+#ifdef __APPLE__
+#define SYM(name) "_" #name
+#define TYPE(name)
+#else
+#define SYM(name) #name
+#define TYPE(name) ".type " #name ", @function\n"
+#endif
+
+// salva o contexto corrente em *save_sp e retoma o contexto salvo em new_sp
+void ctx_switch(void **save_sp, void *new_sp);
+
+// ponto de entrada de uma tarefa nova: chama start_func(arg), que estão em
+// registradores preservados preparados por ctx_make
+void ctx_entry(void);
+
+#if defined(__x86_64__)
+
+// pilha salva: mxcsr e palavra de controle x87, r15, r14, r13, r12, rbx, rbp
+// e o endereço de retorno
+#define CTX_WORDS 8
+
+__asm__(".text\n"
+        ".globl " SYM(ctx_switch) "\n"
+        TYPE(ctx_switch)
+        SYM(ctx_switch) ":\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    subq $8, %rsp\n"
+        "    stmxcsr (%rsp)\n"
+        "    fnstcw 4(%rsp)\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    ldmxcsr (%rsp)\n"
+        "    fldcw 4(%rsp)\n"
+        "    addq $8, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".globl " SYM(ctx_entry) "\n"
+        TYPE(ctx_entry)
+        SYM(ctx_entry) ":\n"
+        "    movq %r13, %rdi\n"
+        "    callq *%r12\n"
+        "    ud2\n");
+
+void ctx_make(task_t *task, void (*start_func)(void *), void *arg) {
+    char *top = (char *)task->context.uc_stack.ss_sp + task->context.uc_stack.ss_size;
+
+    // após o ret para ctx_entry a pilha fica alinhada em 16 bytes, como a
+    // convenção exige antes de uma chamada
+    uint64_t *sp = (uint64_t *)((uintptr_t)(top - 16) & ~(uintptr_t)15) - CTX_WORDS;
+
+    memset(sp, 0, CTX_WORDS * sizeof(uint64_t));
+    sp[0] = 0x1f80 | (0x037fULL << 32);  // mxcsr e controle x87 padrão
+    sp[3] = (uint64_t)(uintptr_t)arg;        // r13
+    sp[4] = (uint64_t)(uintptr_t)start_func; // r12
+    sp[7] = (uint64_t)(uintptr_t)ctx_entry;  // endereço de retorno
+
+    task->stack_ptr = sp;
+}
+
+#elif defined(__aarch64__)
+
+// pilha salva: x19 a x30 (x29 é o frame pointer e x30 o endereço de
+// retorno) e d8 a d15
+#define CTX_WORDS 20
+
+__asm__(".text\n"
+        ".globl " SYM(ctx_switch) "\n"
+        TYPE(ctx_switch)
+        SYM(ctx_switch) ":\n"
+        "    sub sp, sp, #160\n"
+        "    stp x19, x20, [sp, #0]\n"
+        "    stp x21, x22, [sp, #16]\n"
+        "    stp x23, x24, [sp, #32]\n"
+        "    stp x25, x26, [sp, #48]\n"
+        "    stp x27, x28, [sp, #64]\n"
+        "    stp x29, x30, [sp, #80]\n"
+        "    stp d8, d9, [sp, #96]\n"
+        "    stp d10, d11, [sp, #112]\n"
+        "    stp d12, d13, [sp, #128]\n"
+        "    stp d14, d15, [sp, #144]\n"
+        "    mov x2, sp\n"
+        "    str x2, [x0]\n"
+        "    mov sp, x1\n"
+        "    ldp x19, x20, [sp, #0]\n"
+        "    ldp x21, x22, [sp, #16]\n"
+        "    ldp x23, x24, [sp, #32]\n"
+        "    ldp x25, x26, [sp, #48]\n"
+        "    ldp x27, x28, [sp, #64]\n"
+        "    ldp x29, x30, [sp, #80]\n"
+        "    ldp d8, d9, [sp, #96]\n"
+        "    ldp d10, d11, [sp, #112]\n"
+        "    ldp d12, d13, [sp, #128]\n"
+        "    ldp d14, d15, [sp, #144]\n"
+        "    add sp, sp, #160\n"
+        "    ret\n"
+        ".globl " SYM(ctx_entry) "\n"
+        TYPE(ctx_entry)
+        SYM(ctx_entry) ":\n"
+        "    mov x0, x20\n"
+        "    blr x19\n"
+        "    brk #0\n");
+
+void ctx_make(task_t *task, void (*start_func)(void *), void *arg) {
+    char *top = (char *)task->context.uc_stack.ss_sp + task->context.uc_stack.ss_size;
+
+    // a pilha é sempre mantida alinhada em 16 bytes
+    uint64_t *sp = (uint64_t *)((uintptr_t)(top - 16) & ~(uintptr_t)15) - CTX_WORDS;
+
+    memset(sp, 0, CTX_WORDS * sizeof(uint64_t));
+    sp[0] = (uint64_t)(uintptr_t)start_func; // x19
+    sp[1] = (uint64_t)(uintptr_t)arg;        // x20
+    sp[11] = (uint64_t)(uintptr_t)ctx_entry; // x30
+
+    task->stack_ptr = sp;
+}
+
+#endif
+
+#endif